@@ -139,6 +139,17 @@ brelse(struct buf *b)
   
   release(&bcache.lock);
 }
+
+// Add up the contention statistics of the buffer locks.
+void
+bstat(lockstat_t *st)
+{
+  struct buf *b;
+
+  for(b = bcache.buf; b < bcache.buf+NBUF; b++)
+    sleeplockstat(&b->lock, st);
+}
+
 //PAGEBREAK!
 // Blank page.
 
@@ -5,6 +5,8 @@ struct inode;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct schedlat;
+struct schedparam;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -15,6 +17,7 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bstat(lockstat_t*);
 
 // console.c
 void            consoleinit(void);
@@ -22,6 +25,7 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 int             exec(char*, char**);
+pde_t*          loadexec(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -40,9 +44,12 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+struct inode*   iexec(struct inode*);
 void            iinit(int dev);
+void            istat(lockstat_t*);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            iunexec(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -68,6 +75,8 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kref(char*);
+int             krefs(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -78,6 +87,7 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(uchar, int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -107,6 +117,9 @@ int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+struct proc*    vmowner(struct proc*);
+int             heapfault(struct proc*, uint);
+int             spawn(char*, char**, int*);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
@@ -120,21 +133,44 @@ void            sleept(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+void            wakeone(void*);
+int             wakeupn(void*, int);
 int             yield(void);
-void            mlfqelpsd(int);
 int             set_cpu_share(int);
+int             getschedlat(int, struct schedlat*);
+int             set_affinity(int, uint);
 struct proc*    schproc(struct proc*);
 int             thread_create(thread_t*, void* (void*), void*);
+int             thread_create_attr(thread_t*, void* (void*), void*, thread_attr_t*);
 void            thread_exit(void*) __attribute__((noreturn));
 int             thread_join(thread_t, void**);
+int             thread_park(void);
+int             thread_unpark(thread_t);
+void            lwpflush(struct proc*);
+int             getlwpstat(lwpstat_t*);
+int             lwpfault(struct proc*, uint);
+int             lwpmapuser(struct proc*, uint, char*);
 
 // scheduler.c
-struct proc*    nextproc();
+void            rqinit(void);
+struct proc*    nextproc(int);
+void            qbalance(int);
 int             qpush(struct proc*);
 int             qpop(struct proc*);
-int             qdown(struct proc*);
-void            qboost(int);
+void            qupdate(struct proc*);
+int             qlevel(struct proc*);
+int             qdown(struct proc*, uint64);
+void            qtick(int, struct proc*);
+void            tsccalib(void);
+int             setwakeup(int);
+int             setparam(struct schedparam*);
+void            getparam(struct schedparam*);
 int             setsshr(struct proc*, int);
+int             setaffinity(struct proc*, uint);
+
+// schedtrace.c
+void            schedtraceinit(void);
+void            schedev(int, struct proc*, int);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -149,20 +185,15 @@ void            pushcli(void);
 void            popcli(void);
 
 // semaphore.c
-int             xem_init(xem_t*);
-int             xem_wait(xem_t*);
-int             xem_post(xem_t*);
-int             rwlock_init(rwlock_t*);
-int             rwlock_acquire_readlock(rwlock_t*);
-int             rwlock_acquire_writelock(rwlock_t*);
-int             rwlock_release_readlock(rwlock_t*);
-int             rwlock_release_writelock(rwlock_t*);
+void            futexinit(void);
+int             futex(uint*, int, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            sleeplockstat(struct sleeplock*, lockstat_t*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -203,14 +234,22 @@ pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+int             unmapuvm(pde_t*, uint, uint);
+void            tlbshootdown(pde_t*);
+void            tlbpoll(void);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint, uint);
+pde_t*          copyuvm(pde_t*, uint, uint, uint, int);
+int             uvmunshare(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             mapuser(pde_t*, uint, char*);
+int             mapzero(pde_t*, uint);
+int             pgfault(uint, uint);
+int             prefault(uint, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -6,28 +6,39 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
 
-int
-exec(char *path, char **argv)
+// Load the program at path with argv into a new page table
+// for p, and set up its size, name, segments and the registers
+// of its trap frame. The segments are only recorded; pgfault()
+// reads their pages on first touch. p->pgdir and the old
+// p->exip are left to the caller. Return the page table, or 0
+// with p untouched.
+pde_t*
+loadexec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
+  int i, off, nseg;
+  uint argc, sz, sp, tlsbase, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  struct execseg seg[NEXSEG];
+  pde_t *pgdir;
 
   begin_op();
 
   if((ip = namei(path)) == 0){
     end_op();
     cprintf("exec: fail\n");
-    return -1;
+    return 0;
   }
   ilock(ip);
   pgdir = 0;
+  exip = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,8 +49,9 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the segments of the program.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -49,14 +61,25 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= LWPBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
+    if(nseg == NEXSEG)
+      goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // Keep the inode to read the pages from.
+  exip = iexec(ip);
+  iunlock(ip);
   end_op();
   ip = 0;
 
@@ -66,7 +89,13 @@ exec(char *path, char **argv)
   if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
   clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
-  sp = sz;
+
+  // Thread-local storage takes the top of the stack. Its first
+  // word holds its own address.
+  sp = sz - TLSSIZE;
+  tlsbase = sp;
+  if(copyout(pgdir, sp, &tlsbase, 4) < 0)
+    goto bad;
 
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
@@ -91,18 +120,19 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  if(curproc->oproc == 0)
-    freevm(oldpgdir);
-  return 0;
+  p->sz = sz;
+  p->sksz = 0;
+  p->skguard = 0;
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
+  p->tf->gs = (SEG_UTLS << 3) | DPL_USER;
+  p->tlsbase = tlsbase;
+  p->exip = exip;
+  memmove(p->exseg, seg, sizeof(seg));
+  p->nexseg = nseg;
+  return pgdir;
 
  bad:
   if(pgdir)
@@ -111,5 +141,41 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
-  return -1;
+  if(exip){
+    iunexec(exip);
+    begin_op();
+    iput(exip);
+    end_op();
+  }
+  return 0;
+}
+
+int
+exec(char *path, char **argv)
+{
+  pde_t *pgdir, *oldpgdir;
+  struct inode *oldip;
+  struct proc *curproc = myproc();
+
+  oldip = curproc->exip;
+  if((pgdir = loadexec(curproc, path, argv)) == 0)
+    return -1;
+
+  // Commit to the user image.
+  oldpgdir = curproc->pgdir;
+  curproc->pgdir = pgdir;
+  switchuvm(curproc);
+  if(curproc->oproc == 0){
+    // LWPs left may still have it in their TLBs.
+    tlbshootdown(oldpgdir);
+    freevm(oldpgdir);
+    lwpflush(curproc);
+    if(oldip){
+      iunexec(oldip);
+      begin_op();
+      iput(oldip);
+      end_op();
+    }
+  }
+  return 0;
 }
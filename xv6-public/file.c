@@ -139,7 +139,10 @@ filewrite(struct file *f, char *addr, int n)
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+      // The file may have been run since it was opened.
+      if(f->ip->nexec > 0)
+        r = -1;
+      else if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
@@ -196,7 +199,7 @@ filepwrite(struct file *f, char *addr, int n, int off)
 
       begin_op();
       ilock(f->ip);
-      r = writei(f->ip, addr + i, off, n1);
+      r = f->ip->nexec > 0 ? -1 : writei(f->ip, addr + i, off, n1);
       iunlock(f->ip);
       end_op();
 
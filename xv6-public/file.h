@@ -14,6 +14,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nexec;          // Running programs paging from it; writes fail if non-zero
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
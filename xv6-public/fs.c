@@ -185,6 +185,16 @@ iinit(int dev)
           sb.bmapstart);
 }
 
+// Add up the contention statistics of the inode locks.
+void
+istat(lockstat_t *st)
+{
+  int i;
+
+  for(i = 0; i < NINODE; i++)
+    sleeplockstat(&icache.inode[i].lock, st);
+}
+
 static struct inode* iget(uint dev, uint inum);
 
 //PAGEBREAK!
@@ -282,6 +292,29 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Mark ip as the program of a process, which reads its pages
+// from ip until iunexec(). Writes to ip fail meanwhile, so
+// they can't change a running program. The caller holds a
+// reference to ip, and the lock if it checks ip->nexec.
+struct inode*
+iexec(struct inode *ip)
+{
+  acquire(&icache.lock);
+  ip->nexec++;
+  release(&icache.lock);
+  return ip;
+}
+
+void
+iunexec(struct inode *ip)
+{
+  acquire(&icache.lock);
+  if(ip->nexec <= 0)
+    panic("iunexec");
+  ip->nexec--;
+  release(&icache.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
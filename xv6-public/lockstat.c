@@ -0,0 +1,48 @@
+// Show the contention of the buffer and inode sleeplocks,
+// during a command if one is given.
+// usage: lockstat [command args...]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+char *names[] = { "buffer", "inode" };
+
+void
+report(char *name, lockstat_t *a, lockstat_t *b)
+{
+  printf(1, "%s: acquire %d contend %d spin %d sleep %d spun %d Kcycles\n",
+         name, b->nacquire - a->nacquire, b->ncontend - a->ncontend,
+         b->nspin - a->nspin, b->nsleep - a->nsleep,
+         (uint)((b->spincycles - a->spincycles) >> 10));
+}
+
+int
+main(int argc, char *argv[])
+{
+  lockstat_t before[2], after[2];
+  int i, pid;
+
+  memset(before, 0, sizeof(before));
+  if(argc > 1){
+    for(i = LS_BUF; i <= LS_INODE; i++)
+      getlockstat(i, &before[i]);
+    pid = fork();
+    if(pid < 0){
+      printf(2, "lockstat: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      printf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit();
+    }
+    wait();
+  }
+
+  for(i = LS_BUF; i <= LS_INODE; i++){
+    getlockstat(i, &after[i]);
+    report(names[i], &before[i], &after[i]);
+  }
+  exit();
+}
@@ -0,0 +1,70 @@
+// Create and join LWPs in rounds on the given CPUs, then show
+// how often the stack caches of the group were hit.
+// usage: lwpstat [cpumask [nthread [rounds]]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NTHREADMAX 32
+
+void*
+nop(void *arg)
+{
+  thread_exit(arg);
+  return 0;
+}
+
+// a*100/b, or 0 if b is zero.
+uint
+pct(uint a, uint b)
+{
+  return b == 0 ? 0 : a * 100 / b;
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t[NTHREADMAX];
+  lwpstat_t st;
+  void *ret;
+  int nthread = 8, rounds = 100, start, i, r;
+  uint mask = ~0;
+
+  if(argc > 1)
+    mask = atoi(argv[1]);
+  if(argc > 2)
+    nthread = atoi(argv[2]);
+  if(argc > 3)
+    rounds = atoi(argv[3]);
+  if(nthread <= 0 || nthread > NTHREADMAX){
+    printf(2, "lwpstat: 1 to %d threads\n", NTHREADMAX);
+    exit();
+  }
+
+  // LWPs inherit the affinity.
+  if(set_affinity(0, mask) < 0){
+    printf(2, "lwpstat: cannot set affinity %d\n", mask);
+    exit();
+  }
+
+  start = uptime();
+  for(r = 0; r < rounds; r++){
+    for(i = 0; i < nthread; i++)
+      if(thread_create(&t[i], nop, (void*)i) < 0){
+        printf(2, "lwpstat: thread_create failed\n");
+        exit();
+      }
+    for(i = 0; i < nthread; i++)
+      thread_join(t[i], &ret);
+  }
+
+  getlwpstat(&st);
+  printf(1, "%d LWPs in %d ticks on CPUs 0x%x\n", nthread*rounds,
+         uptime() - start, mask);
+  printf(1, "user stacks: hit %d miss %d (%d%%)\n", st.stkhit, st.stkmiss,
+         pct(st.stkhit, st.stkhit + st.stkmiss));
+  printf(1, "kernel stacks: hit %d miss %d (%d%%)\n", st.kshit, st.ksmiss,
+         pct(st.kshit, st.kshit + st.ksmiss));
+  exit();
+}
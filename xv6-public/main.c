@@ -27,6 +27,8 @@ main(void)
   consoleinit();   // console hardware
   uartinit();      // serial port
   pinit();         // process table
+  schedtraceinit(); // scheduler trace
+  futexinit();     // futex buckets
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
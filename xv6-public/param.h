@@ -1,6 +1,10 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define NKSCACHE      8  // cached kernel stacks of an LWP group
+#define TLSSIZE     256  // bytes of thread-local storage, atop the stack
+#define NEXSEG        4  // loadable segments of a program
+#define NWAITQ       64  // hash buckets of sleeping processes
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
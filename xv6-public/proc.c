@@ -6,10 +6,12 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sched.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct waitq waitq[NWAITQ];  // Sleeping processes by channel
 } ptable;
 
 struct {
@@ -22,12 +24,15 @@ int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
+static int wakeup1(void *chan, int n);
+static void lwplink(struct proc *p);
+static void lwpunlink(struct proc *p);
 
 void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  rqinit();
 }
 
 // Must be called with interrupts disabled
@@ -74,8 +79,10 @@ myproc(void) {
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
+// Use kstack as the kernel stack if non-zero; otherwise
+// allocate a new one.
 static struct proc*
-allocproc(void)
+allocproc1(char *kstack)
 {
   struct proc *p;
   char *sp;
@@ -92,11 +99,31 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->sksz = 0;
+  p->skguard = 0;
+  p->exip = 0;
+  p->nexseg = 0;
+  p->twake = 0;
+  p->nwake = 0;
+  p->maxlat = 0;
+  p->sumlat = 0;
+  p->schproc = 0;
+  p->thead = 0;
+  p->tnext = 0;
+  p->tprev = 0;
+  p->tcur = 0;
+  memset(p->lwpmap, 0, sizeof(p->lwpmap));
+  memset(p->lwpcache, 0, sizeof(p->lwpcache));
+  p->nkscache = 0;
+  memset(&p->lwpstat, 0, sizeof(p->lwpstat));
+  p->permit = 0;
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
-  if((p->kstack = kalloc()) == 0){
+  if(kstack != 0)
+    p->kstack = kstack;
+  else if((p->kstack = kalloc()) == 0){
     p->state = UNUSED;
     return 0;
   }
@@ -119,6 +146,12 @@ found:
   return p;
 }
 
+static struct proc*
+allocproc(void)
+{
+  return allocproc1(0);
+}
+
 //PAGEBREAK: 32
 // Set up first user process.
 void
@@ -146,8 +179,8 @@ userinit(void)
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
-  p->schidx = 0;
   p->lwpidx = 0;
+  p->affinity = ~0;
 
   // this assignment to p->state lets other cores
   // run this process. the acquire forces the above
@@ -161,39 +194,72 @@ userinit(void)
   release(&ptable.lock);
 }
 
-// Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// The process whose size and program describe the page table
+// of p: the representative of its group, or p itself if it
+// has a page table of its own.
+struct proc*
+vmowner(struct proc *p)
+{
+  struct proc *q = schproc(p);
+
+  return q->pgdir == p->pgdir ? q : p;
+}
+
+// Grow current process's memory by n bytes. LWPs grow the
+// heap of their group. Growing only moves sz; pgfault() maps
+// the pages on first touch.
+// Return the old size on success, -1 on failure.
 int
 growproc(int n)
 {
   uint sz;
   struct proc *curproc = myproc();
+  struct proc *q = vmowner(curproc);
 
 #ifdef LWPFKDEBUG
-  cprintf("[growproc] (%d) start %d\n", curproc->pid, curproc->sz);
+  cprintf("[growproc] (%d) start %d\n", curproc->pid, q->sz);
 #endif
 
-  sz = curproc->sz;
+  acquire(&lwpgroup.lock);
+  sz = q->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n < sz || sz + n > LWPBASE){
+      release(&lwpgroup.lock);
       return -1;
+    }
+    q->sz = sz + n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n > sz){
+      release(&lwpgroup.lock);
       return -1;
+    }
+    q->sz = unmapuvm(q->pgdir, sz, sz + n);
   }
-  curproc->sz = sz;
-
-  // Update sz
-  //acquire(&ptable.lock);
-  //release(&ptable.lock);
+  release(&lwpgroup.lock);
 
 #ifdef LWPFKDEBUG
-  cprintf("[growproc] (%d) end %d\n", curproc->pid, curproc->sz);
+  cprintf("[growproc] (%d) end %d\n", curproc->pid, q->sz);
 #endif
 
   switchuvm(curproc);
 
-  return 0;
+  return sz;
+}
+
+// Map a zeroed page at va if it's in the heap of p.
+// Return 0 if it's mapped now.
+int
+heapfault(struct proc *p, uint va)
+{
+  struct proc *q = vmowner(p);
+  int r = -1;
+
+  acquire(&lwpgroup.lock);
+  if(va < q->sz)
+    r = mapzero(p->pgdir, va);
+  release(&lwpgroup.lock);
+
+  return r;
 }
 
 // Create a new process copying p as the parent.
@@ -202,9 +268,9 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int i, pid, cow;
   uint sz;
-  struct proc *np;
+  struct proc *np, *q;
   struct proc *curproc = myproc();
 
 #ifdef LWPFKDEBUG
@@ -224,18 +290,33 @@ fork(void)
 #ifdef LWPFKDEBUG
     cprintf("[fork] (%d) %d sz %d\n", curproc->pid, np->pid, sz);
 #endif
-  if((np->pgdir = copyuvm(curproc->pgdir, sz, curproc->sksz)) == 0){
+  // Share the pages copy-on-write, unless other LWPs use the
+  // page table. Their TLBs couldn't be flushed.
+  cow = curproc->oproc == 0 && curproc->thead == 0;
+  if((np->pgdir = copyuvm(curproc->pgdir, sz, curproc->sksz, curproc->sz, cow)) == 0){
 #ifdef LWPFKDEBUG
     cprintf("[fork] (%d) %d copyuvm fail\n", curproc->pid, np->pid);
 #endif
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
+    if(cow)
+      lcr3(V2P(curproc->pgdir));
     return -1;
   }
+  if(cow)
+    lcr3(V2P(curproc->pgdir));
   np->sz = curproc->sz;
   np->sksz = curproc->sksz;
+  np->skguard = curproc->skguard;
   np->hpsz = curproc->hpsz;
+  np->tlsbase = curproc->tlsbase;
+  // The child pages in the same program.
+  q = vmowner(curproc);
+  if(q->exip != 0)
+    np->exip = iexec(idup(q->exip));
+  memmove(np->exseg, q->exseg, sizeof(q->exseg));
+  np->nexseg = q->nexseg;
   np->parent = curproc;
   np->oproc = curproc->oproc;
   *np->tf = *curproc->tf;
@@ -250,8 +331,8 @@ fork(void)
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
-  np->schidx = -1;
   np->lwpidx = 0;
+  np->affinity = curproc->affinity;
 
   pid = np->pid;
 
@@ -261,6 +342,7 @@ fork(void)
     qpush(np);
   }else{
     np->schproc = curproc->schproc;
+    lwplink(np);
   }
 
   np->state = RUNNABLE;
@@ -274,6 +356,66 @@ fork(void)
   return pid;
 }
 
+// Create a new process running path with argv, like fork()
+// and exec() but without copying the address space of the
+// caller. fd i of the child is fd fdmap[i] of the caller, or
+// closed if it's -1; a null fdmap passes all of them.
+// Return the pid of the child, or -1.
+int
+spawn(char *path, char **argv, int *fdmap)
+{
+  int i, fd, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if(fdmap != 0){
+    for(i = 0; i < NOFILE; i++){
+      fd = fdmap[i];
+      if(fd != -1 && (fd < 0 || fd >= NOFILE || curproc->ofile[fd] == 0))
+        return -1;
+    }
+  }
+
+  // Allocate process.
+  if((np = allocproc()) == 0)
+    return -1;
+
+  memset(np->tf, 0, sizeof(*np->tf));
+  np->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  np->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  np->tf->es = np->tf->ds;
+  np->tf->ss = np->tf->ds;
+  np->tf->eflags = FL_IF;
+
+  if((np->pgdir = loadexec(np, path, argv)) == 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->hpsz = curproc->hpsz;
+  np->parent = curproc;
+  np->oproc = 0;
+  np->lwpidx = 0;
+  np->affinity = curproc->affinity;
+
+  for(i = 0; i < NOFILE; i++){
+    fd = fdmap != 0 ? fdmap[i] : i;
+    if(fd != -1 && curproc->ofile[fd])
+      np->ofile[i] = filedup(curproc->ofile[fd]);
+  }
+  np->cwd = idup(curproc->cwd);
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+  qpush(np);
+  np->state = RUNNABLE;
+  release(&ptable.lock);
+
+  return pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -303,19 +445,20 @@ exit(void)
   acquire(&ptable.lock);
 
   // Parent might be sleeping in wait().
-  wakeup1(curproc->parent);
+  wakeup1(curproc->parent, NPROC);
 
   // Pass abandoned children to init.
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->parent == curproc){
       p->parent = initproc;
       if(p->state == ZOMBIE)
-        wakeup1(initproc);
+        wakeup1(initproc, NPROC);
     }
   }
 
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
+  qupdate(curproc);
   sched();
   panic("zombie exit");
 }
@@ -326,6 +469,7 @@ int
 wait(void)
 {
   struct proc *p;
+  struct inode *ip;
   int havekids, pid;
   struct proc *curproc = myproc();
   
@@ -341,16 +485,33 @@ wait(void)
         // Found one.
         if(p->oproc == 0)
           qpop(p);
+        if(p->schproc != 0)
+          lwpunlink(p);
+        // LWPs left behind can't be scheduled any more.
+        while(p->thead != 0)
+          lwpunlink(p->thead);
+        if(p->oproc == 0)
+          lwpflush(p);
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
+        // The program goes with the page table, but iput()
+        // may sleep.
+        ip = p->exip;
+        p->exip = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
         p->state = UNUSED;
         release(&ptable.lock);
+        if(ip != 0){
+          iunexec(ip);
+          begin_op();
+          iput(ip);
+          end_op();
+        }
         return pid;
       }
     }
@@ -369,6 +530,129 @@ wait(void)
   }
 }
 
+// Link the LWP p into the list of its group.
+// Caller must hold ptable.lock.
+static void
+lwplink(struct proc *p)
+{
+  struct proc *sp = p->schproc;
+
+  p->tprev = 0;
+  p->tnext = sp->thead;
+  if(sp->thead != 0)
+    sp->thead->tprev = p;
+  sp->thead = p;
+}
+
+// Unlink the LWP p from the list of its group.
+// Caller must hold ptable.lock.
+static void
+lwpunlink(struct proc *p)
+{
+  struct proc *sp = p->schproc;
+
+  // nextlwp() goes on from the previous one.
+  if(sp->tcur == p)
+    sp->tcur = p->tprev;
+  if(p->tprev != 0)
+    p->tprev->tnext = p->tnext;
+  else
+    sp->thead = p->tnext;
+  if(p->tnext != 0)
+    p->tnext->tprev = p->tprev;
+  p->tnext = 0;
+  p->tprev = 0;
+  p->schproc = 0;
+}
+
+// Take a free LWP stack index of the group sp. An index in
+// lwpcache comes first, and *cached tells whether its stack
+// is still mapped. Caller must hold lwpgroup.lock.
+static int
+lwpalloc(struct proc *sp, int *cached)
+{
+  uint free;
+  int i;
+
+  for(i = 0; i < NELEM(sp->lwpcache); i++){
+    free = sp->lwpcache[i];
+    if(free != 0){
+      free &= -free;
+      sp->lwpcache[i] &= ~free;
+      sp->lwpmap[i] |= free;
+      sp->lwpstat.stkhit++;
+      *cached = 1;
+      return i*32 + bsf(free);
+    }
+  }
+
+  *cached = 0;
+  for(i = 0; i < NELEM(sp->lwpmap); i++){
+    free = ~sp->lwpmap[i];
+    // Index 0 is the stack of the process itself.
+    if(i == 0)
+      free &= ~1;
+    if(free != 0){
+      sp->lwpmap[i] |= free & -free;
+      sp->lwpstat.stkmiss++;
+      return i*32 + bsf(free);
+    }
+  }
+  return -1;
+}
+
+// Caller must hold lwpgroup.lock.
+static void
+lwpfree(struct proc *sp, int idx)
+{
+  sp->lwpmap[idx/32] &= ~(1 << (idx%32));
+}
+
+// Keep the stack of idx mapped for the next LWP of the group.
+// Caller must hold lwpgroup.lock.
+static void
+lwpkeep(struct proc *sp, int idx)
+{
+  lwpfree(sp, idx);
+  sp->lwpcache[idx/32] |= 1 << (idx%32);
+}
+
+// Take a cached kernel stack of the group sp, or 0.
+// Caller must hold lwpgroup.lock.
+static char*
+kspop(struct proc *sp)
+{
+  if(sp->nkscache == 0){
+    sp->lwpstat.ksmiss++;
+    return 0;
+  }
+  sp->lwpstat.kshit++;
+  return sp->kscache[--sp->nkscache];
+}
+
+// Return kstack to the cache of the group sp, or free it
+// if the cache is full. Caller must hold lwpgroup.lock.
+static void
+kspush(struct proc *sp, char *kstack)
+{
+  if(sp->nkscache == NKSCACHE)
+    kfree(kstack);
+  else
+    sp->kscache[sp->nkscache++] = kstack;
+}
+
+// Drop the caches of the group p, whose user stacks are
+// about to be unmapped or are gone already.
+void
+lwpflush(struct proc *p)
+{
+  acquire(&lwpgroup.lock);
+  while(p->nkscache > 0)
+    kfree(p->kscache[--p->nkscache]);
+  memset(p->lwpcache, 0, sizeof(p->lwpcache));
+  release(&lwpgroup.lock);
+}
+
 // Find the topmost process
 struct proc*
 schproc(struct proc *curproc)
@@ -384,66 +668,107 @@ schproc(struct proc *curproc)
 // Caller must set state of returned proc to RUNNABLE.
 int
 thread_create(thread_t *thread, void* (*start_routine)(void *), void *arg)
+{
+  return thread_create_attr(thread, start_routine, arg, 0);
+}
+
+// Same as thread_create(), with the stack described by attr.
+// The stack takes the top of the VA slot of its stack index,
+// and only its top page is mapped here; the rest is mapped on
+// first touch by lwpfault(). The guard beneath it is never
+// mapped, and lwpfault() refuses it. A null attr means a page
+// of stack and of guard.
+int
+thread_create_attr(thread_t *thread, void* (*start_routine)(void *), void *arg,
+                   thread_attr_t *attr)
 {
   // Based on fork()
-  int i, sidx[NPROC] = {0};
-  uint sksz, sp, ustack[2];
-  struct proc *np, *p;
+  int i, cached;
+  uint sksz, sktop, stksz, guard, sp, ustack[2], tls[TLSSIZE/4];
+  char *kstack;
+  struct proc *np, *gp;
   struct proc *curproc = myproc();
 
 #ifdef LWPDEBUG
   cprintf("[t_create] (%d) start\n", curproc->pid);
 #endif
 
-  // Avoid double-mark in stack index
-  acquire(&lwpgroup.lock);
-
-  // Mark used stack index
-  acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->oproc == curproc)
-      sidx[p->lwpidx] = 1;
+  // Both must fit in the slot
+  stksz = PGSIZE;
+  guard = PGSIZE;
+  if(attr != 0){
+    stksz = attr->stacksize ? PGROUNDUP(attr->stacksize) : PGSIZE;
+    guard = PGROUNDUP(attr->guardsize);
+    if(stksz > LWPSLOT || guard > LWPSLOT - stksz)
+      return -1;
   }
-  release(&ptable.lock);
 
-  // Get available stack index
-  for(i = 1; i < NPROC; i++){
-    if(sidx[i] == 0)
-      break;
+  // Stack indexes are shared by the whole group
+  gp = schproc(curproc);
+
+  // The first LWP will share the page table, so copy the pages
+  // still shared with a forked process first.
+  if(curproc == gp && gp->thead == 0){
+    if(uvmunshare(curproc->pgdir, curproc->hpsz > curproc->sz ?
+                  curproc->hpsz : curproc->sz) < 0)
+      return -1;
+    lcr3(V2P(curproc->pgdir));
   }
 
-  // No available stack index
-  if(i == NPROC){
-    release(&lwpgroup.lock);
+  // Allocate process, with a cached kernel stack if any
+  acquire(&lwpgroup.lock);
+  kstack = kspop(gp);
+  release(&lwpgroup.lock);
+
+  if((np = allocproc1(kstack)) == 0){
+    if(kstack != 0){
+      acquire(&lwpgroup.lock);
+      kspush(gp, kstack);
+      release(&lwpgroup.lock);
+    }
 #ifdef LWPDEBUG
-    cprintf("[t_create] (%d) no stack index\n", curproc->pid);
+    cprintf("[t_create] (%d) allocproc fail\n", curproc->pid);
 #endif
     return -1;
   }
 
-#ifdef LWPDEBUG
-    cprintf("[t_create] (%d) stack index %d selected\n", curproc->pid, i);
-#endif
+  // Avoid double-mark in stack index
+  acquire(&lwpgroup.lock);
 
-  // Allocate process
-  if((np = allocproc()) == 0){
+  // Get available stack index
+  if((i = lwpalloc(gp, &cached)) < 0){
+    kspush(gp, np->kstack);
     release(&lwpgroup.lock);
+    np->kstack = 0;
+    np->state = UNUSED;
 #ifdef LWPDEBUG
-    cprintf("[t_create] (%d) allocproc fail\n", curproc->pid);
+    cprintf("[t_create] (%d) no stack index\n", curproc->pid);
 #endif
     return -1;
   }
 
+#ifdef LWPDEBUG
+    cprintf("[t_create] (%d) stack index %d selected\n", curproc->pid, i);
+#endif
+
   // Update lwp
   np->oproc = curproc;
   np->lwpidx = i;
 
   // Based on exec()
-  // Allocate stack segment
-  sksz = PGROUNDUP(KERNBASE - ((np->lwpidx+1) * 2*PGSIZE));
-
-  if((sksz = allocuvm(curproc->pgdir, sksz, sksz + 2*PGSIZE)) == 0){
-    kfree(np->kstack);
+  // Allocate the top page of stack segment
+  sktop = KERNBASE - np->lwpidx*LWPSLOT;
+  sksz = sktop - stksz;
+  gp->lwpstk[i] = sksz;
+
+  // A cached stack keeps the pages its last LWP touched. Those
+  // below the new stack would be in the guard, so unmap them,
+  // from the TLBs of this CPU and of the LWPs on others too.
+  if(cached)
+    unmapuvm(curproc->pgdir, sksz, sktop - LWPSLOT);
+  else if(allocuvm(curproc->pgdir, sktop - PGSIZE, sktop) == 0){
+    lwpfree(gp, i);
+    kspush(gp, np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     release(&lwpgroup.lock);
@@ -454,27 +779,33 @@ thread_create(thread_t *thread, void* (*start_routine)(void *), void *arg)
 
     return -1;
   }
-  clearpteu(curproc->pgdir, (char*)(sksz - 2*PGSIZE));
-  sp = sksz;
+  sp = sktop;
 
 #ifdef LWPDEBUG
-  cprintf("[t_create] (%d) %d allocuvm on %d, %d\n", np->oproc->pid, np->pid, np->lwpidx, sksz);
+  cprintf("[t_create] (%d) %d allocuvm on %d, %d\n", np->oproc->pid, np->pid, np->lwpidx, sktop);
   cprintf("[t_create] (%d) %d sz: %d, sksz: %d\n", np->oproc->pid, np->pid, np->oproc->sz, sksz);
 #endif
 
   release(&lwpgroup.lock);
 
+  // Set thread-local storage atop the stack. A cached stack
+  // may hold the old one, so clear it all.
+  sp -= TLSSIZE;
+  memset(tls, 0, sizeof(tls));
+  tls[0] = sp;
+
   // Set stack segment
   ustack[0] = 0xffffffff;
   ustack[1] = (uint)arg;
 
-  sp -= 2*4;
-
-  if(copyout(curproc->pgdir, sp, ustack, 2*4) < 0){
-    kfree(np->kstack);
+  if(copyout(curproc->pgdir, sp, tls, TLSSIZE) < 0 ||
+     copyout(curproc->pgdir, sp - 2*4, ustack, 2*4) < 0){
+    acquire(&lwpgroup.lock);
+    kspush(gp, np->kstack);
+    lwpkeep(gp, np->lwpidx);
+    release(&lwpgroup.lock);
     np->kstack = 0;
     np->state = UNUSED;
-    deallocuvm(curproc->pgdir, sksz + 2*PGSIZE, sksz);
 
 #ifdef LWPDEBUG
     cprintf("[t_create] (%d) copyout fail\n", curproc->pid);
@@ -484,17 +815,21 @@ thread_create(thread_t *thread, void* (*start_routine)(void *), void *arg)
 
   // Update proc
   np->pgdir = curproc->pgdir;
-  np->sz = sksz;
+  np->sz = sktop;
   np->hpsz = curproc->hpsz;
-  np->sksz = sksz - 2*PGSIZE;
+  np->sksz = sksz;
+  np->skguard = sksz - guard;
   np->parent = curproc;
-  np->schproc = schproc(curproc);
+  np->schproc = gp;
+  np->affinity = curproc->affinity;
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
   // Update trap frame
   *np->tf = *curproc->tf;
   np->tf->eip = (uint)start_routine;
-  np->tf->esp = sp;
+  np->tf->esp = sp - 2*4;
+  np->tf->gs = (SEG_UTLS << 3) | DPL_USER;
+  np->tlsbase = sp;
 
   // Copy file descriptor
   for(i = 0; i < NOFILE; i++)
@@ -504,6 +839,7 @@ thread_create(thread_t *thread, void* (*start_routine)(void *), void *arg)
 
   acquire(&ptable.lock);
 
+  lwplink(np);
   np->state = RUNNABLE;
 
   release(&ptable.lock);
@@ -545,14 +881,14 @@ thread_exit(void *retval)
   acquire(&ptable.lock);
 
   // Parent might be sleeping in wait().
-  wakeup1(curproc->oproc);
+  wakeup1(curproc->oproc, NPROC);
 
   // Pass abandoned children to oproc.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = curproc->schproc ? curproc->schproc->thead : 0; p != 0; p = p->tnext){
     if(p->oproc == curproc){
       p->parent = curproc->oproc;
       if(p->state == ZOMBIE)
-        wakeup1(curproc->oproc);
+        wakeup1(curproc->oproc, NPROC);
     }
   }
 
@@ -568,50 +904,53 @@ thread_exit(void *retval)
 int
 thread_join(thread_t thread, void **retval)
 {
-  int exist;
-  struct proc *p;
+  struct proc *p, *gp;
   struct proc *curproc = myproc();
+  void *ret;
 
 #ifdef LWPDEBUG
   cprintf("[t_join  ] (%d) start %d\n", curproc->pid, thread);
 #endif
   
   acquire(&ptable.lock);
+  gp = schproc(curproc);
   for(;;){
-    exist = 0;
-    // Scan through table looking for exited LWP.
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    // Scan through the group looking for exited LWP.
+    for(p = gp->thead; p != 0; p = p->tnext){
       if(p->pid != (int)thread)
         continue;
-      exist = 1;
 
 #ifdef LWPDEBUG
   cprintf("[t_join  ] (%d) exist %d\n", curproc->pid, p->pid);
 #endif
 
       if(p->state == ZOMBIE){
-        // Found one.
-        *retval = p->retval;
+        // Found one. retval may fault, so fill it after release.
+        ret = p->retval;
 
 #ifdef LWPDEBUG
         cprintf("[t_join  ] (%d) ZOMBIE %d\n", curproc->pid, thread);
-        cprintf("[t_join  ] (%d) deallocuvm on %d, %d\n", curproc->pid, p->lwpidx, p->sksz);
+        cprintf("[t_join  ] (%d) cache stack on %d, %d\n", curproc->pid, p->lwpidx, p->sksz);
 #endif
 
+        // Keep both stacks for the next thread_create().
+        lwpunlink(p);
         p->oproc = 0;
-        p->schproc = 0;
-        p->schidx = 0;
-        p->lwpidx = 0;
-        kfree(p->kstack);
+        acquire(&lwpgroup.lock);
+        kspush(gp, p->kstack);
+        lwpkeep(gp, p->lwpidx);
+        release(&lwpgroup.lock);
         p->kstack = 0;
-        deallocuvm(p->pgdir, p->sksz + 2*PGSIZE, p->sksz);
+        p->lwpidx = 0;
         p->sksz = 0;
+        p->skguard = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
         p->state = UNUSED;
         release(&ptable.lock);
+        *retval = ret;
 
 #ifdef LWPDEBUG
         cprintf("[t_join  ] (%d) retval of %d is %d\n", curproc->pid, thread, (int)*retval);
@@ -629,7 +968,7 @@ thread_join(thread_t thread, void **retval)
 #endif
 
     // No point waiting if we don't have a thread.
-    if(!exist || curproc->killed){
+    if(p == 0 || curproc->killed){
       release(&ptable.lock);
       return -1;
     }
@@ -643,27 +982,206 @@ thread_join(thread_t thread, void **retval)
   }
 }
 
+// Sleep until another LWP of the group calls thread_unpark(),
+// unless it already has. May return early, so the caller must
+// re-check its condition.
+int
+thread_park(void)
+{
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  if(!curproc->permit && !curproc->killed){
+    // The representative keeps the group scheduled.
+    if(curproc == schproc(curproc))
+      sleept(&curproc->permit, &ptable.lock);
+    else
+      sleep(&curproc->permit, &ptable.lock);
+  }
+  curproc->permit = 0;
+  release(&ptable.lock);
+
+  return 0;
+}
+
+// Give the permit to the LWP thread of the same group and wake
+// it up if it is parked. Looks up only the group.
+int
+thread_unpark(thread_t thread)
+{
+  struct proc *p, *gp;
+
+  acquire(&ptable.lock);
+  gp = schproc(myproc());
+  for(p = gp; p != 0; p = (p == gp) ? gp->thead : p->tnext)
+    if(p->pid == (int)thread)
+      break;
+
+  if(p == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+
+  p->permit = 1;
+  if((p->state == SLEEPING || p->state == TSLEEPING) && p->chan == &p->permit){
+    p->state = RUNNABLE;
+    p->twake = rdtsc();
+    qupdate(p);
+  }
+  release(&ptable.lock);
+
+  return 0;
+}
+
+// Map the page at va if it's in an LWP stack of the group of
+// p. Return 0 if it's mapped now. lwpgroup.lock serializes the
+// faults of the LWPs sharing the page table.
+int
+lwpfault(struct proc *p, uint va)
+{
+  struct proc *gp = schproc(p);
+  int idx, r = -1;
+
+  if(p->sksz != 0 && va >= p->skguard && va < p->sksz){
+    cprintf("pid %d %s: stack overflow into the guard at 0x%x\n",
+            p->pid, p->name, va);
+    return -1;
+  }
+
+  acquire(&lwpgroup.lock);
+  if(p->sksz != 0 && va >= p->sksz && va < p->sz){
+    // Its own stack, even in a copy made by fork()
+    r = mapzero(p->pgdir, va);
+  }else if(gp->pgdir == p->pgdir){
+    // The stack of another LWP, whose address was passed on
+    idx = (KERNBASE - 1 - va) / LWPSLOT;
+    if(idx > 0 && idx < NPROC && (gp->lwpmap[idx/32] & (1 << (idx%32))) &&
+       va >= gp->lwpstk[idx])
+      r = mapzero(p->pgdir, va);
+  }
+  release(&lwpgroup.lock);
+
+  return r;
+}
+
+// mapuser() in the page table of p, serialized with the other
+// LWPs sharing it.
+int
+lwpmapuser(struct proc *p, uint va, char *mem)
+{
+  int r;
+
+  acquire(&lwpgroup.lock);
+  r = mapuser(p->pgdir, va, mem);
+  release(&lwpgroup.lock);
+  return r;
+}
+
+// Copy the stack cache statistics of the calling group.
+int
+getlwpstat(lwpstat_t *st)
+{
+  struct proc *gp = schproc(myproc());
+  lwpstat_t copy;
+
+  acquire(&lwpgroup.lock);
+  copy = gp->lwpstat;
+  release(&lwpgroup.lock);
+  *st = copy;
+  return 0;
+}
+
 struct proc*
 nextlwp(struct proc *schproc)
 {
-  int i, schidx = -1;
-  struct proc *p, *nextproc = 0;
+  uint cpu = 1 << cpuid();
+  struct proc *p;
 
-  for(i = schproc->schidx+1; i < NPROC; i++){
-    p = &ptable.proc[i];
-    if(p->schproc == schproc && p->state == RUNNABLE){
-      nextproc = p;
-      schidx = i;
+  // Go on from the last selected LWP, and select the
+  // representative itself after the last one.
+  p = (schproc->tcur != 0) ? schproc->tcur->tnext : schproc->thead;
+  for(; p != 0; p = p->tnext)
+    if(p->state == RUNNABLE && (p->affinity & cpu))
       break;
+
+  schproc->tcur = p;
+  if(p == 0)
+    return schproc;
+
+  schedev(SE_LWP, schproc, p->pid);
+  return p;
+}
+
+// Account a scheduling latency from wakeup to run.
+static void
+wakelat(struct proc *p, uint64 lat)
+{
+  if(lat > 0xffffffff)
+    lat = 0xffffffff;
+  p->nwake++;
+  p->sumlat += lat;
+  if((uint)lat > p->maxlat)
+    p->maxlat = lat;
+}
+
+// Whether an idle CPU may run the LWP p. Its group must still
+// be scheduled, as nextlwp() only runs LWPs of such a group.
+static int
+lwpready(struct proc *p, int cpu)
+{
+  struct proc *sp = p->schproc;
+
+  return sp != 0 && p->state == RUNNABLE && (p->affinity & (1 << cpu)) &&
+    (sp->state == RUNNABLE || sp->state == RUNNING || sp->state == TSLEEPING);
+}
+
+// Find a runnable LWP which this idle CPU may run, so that
+// the LWPs of a group run on several CPUs at once. Called
+// without ptable.lock, so the caller must re-check it.
+static struct proc*
+idlelwp(int cpu)
+{
+  static int start[NCPU];   // Each CPU resumes its own scan
+  struct proc *p;
+  int i;
+
+  for(i = 0; i < NPROC; i++){
+    p = &ptable.proc[(start[cpu] + i) % NPROC];
+    if(lwpready(p, cpu)){
+      start[cpu] = (start[cpu] + i + 1) % NPROC;
+      return p;
     }
   }
+  return 0;
+}
 
-  if(schidx == -1)
-    nextproc = schproc;
+// Switch to p, which the caller has selected holding
+// ptable.lock, and charge its group when it comes back.
+static void
+run(struct cpu *c, struct proc *p)
+{
+  // Switch to chosen process.  It is the process's job
+  // to release ptable.lock and then reacquire it
+  // before jumping back to us.
+  c->proc = p;
+  switchuvm(p);
+  p->state = RUNNING;
+
+  p->tscin = rdtsc();
+  if(p->twake != 0){
+    wakelat(p, p->tscin - p->twake);
+    p->twake = 0;
+  }
+  swtch(&(c->scheduler), p->context);
+  switchkvm();
 
-  schproc->schidx = schidx;
+  // Charge the cycles to the scheduled process of the group,
+  // whichever CPU the LWP ran on.
+  qdown(p->schproc ? p->schproc : p, rdtsc() - p->tscin);
 
-  return nextproc;
+  // Process is done running for now.
+  // It should have changed its p->state before coming back.
+  c->proc = 0;
 }
 
 //PAGEBREAK: 42
@@ -679,36 +1197,41 @@ scheduler(void)
 {
   struct proc *p = 0;
   struct cpu *c = mycpu();
+  int cpu = c - cpus;
   c->proc = 0;
   
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
+    // Select from the run queue of this CPU without ptable.lock.
+    p = nextproc(cpu);
+    if(p == 0){
+      // Idle, so steal a process from the busiest CPU, or
+      // help a group whose LWPs wait for their turn.
+      qbalance(cpu);
+      if((p = idlelwp(cpu)) == 0)
+        continue;
+
+      acquire(&ptable.lock);
+      if(lwpready(p, cpu)){
+        schedev(SE_LWP, p->schproc, p->pid);
+        run(c, p);
+      }
+      release(&ptable.lock);
+      continue;
+    }
+
     acquire(&ptable.lock);
 
-    p = nextproc();
-    if(p != 0){
+    // The process might have been changed while selecting.
+    if(p->state == RUNNABLE || p->state == TSLEEPING){
       // Select next LWP if available
       p = nextlwp(p);
 #ifdef SCHDEBUG
       //cprintf("[nextlwp] (%d)\n", p->pid);
 #endif
-
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-
-      swtch(&(c->scheduler), p->context);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
+      run(c, p);
     }
     release(&ptable.lock);
   }
@@ -755,47 +1278,126 @@ yield(void)
 int
 sys_yield(void)
 {
-  if(myproc()->qlev >= 0){
-    acquire(&ptable.lock);
-    myproc()->qelpsd++;
-    qdown(myproc());
-    release(&ptable.lock);
-  }
   return yield();
 }
 
-void
-mlfqelpsd(int mlfqticks)
+int
+set_cpu_share(int share)
 {
-  acquire(&ptable.lock);
-  
-  struct proc *schproc = myproc()->schproc;
-  if(schproc == 0)
-    schproc = myproc();
+  return setsshr(myproc(), share);
+}
+
+// wrapper for set_cpu_share()
+int
+sys_set_cpu_share(void)
+{
+  int share;
+  argint(0, &share);
+  return set_cpu_share(share);
+}
+
+// Restrict the process whose ID is pid, or the current process
+// if pid is zero, to the CPUs of mask.
+int
+set_affinity(int pid, uint mask)
+{
+  struct proc *p;
+  int res;
 
-  schproc->qelpsd++;
-  qdown(schproc);
-  qboost(mlfqticks);
+  if(pid == 0)
+    pid = myproc()->pid;
 
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED && p->state != ZOMBIE){
+      res = setaffinity(p, mask);
+      release(&ptable.lock);
+      return res;
+    }
+  }
   release(&ptable.lock);
+  return -1;
 }
 
 int
-set_cpu_share(int share)
+sys_set_affinity(void)
 {
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return set_affinity(pid, mask);
+}
+
+// Copy the wakeup latency of the process whose ID is pid,
+// or of the current process if pid is zero.
+int
+getschedlat(int pid, struct schedlat *lat)
+{
+  struct proc *p;
+  struct schedlat copy;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+
+  // lat may fault, so fill it after release.
   acquire(&ptable.lock);
-  int res = setsshr(myproc(), share);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      copy.nwake = p->nwake;
+      copy.maxlat = p->maxlat;
+      copy.sumlat = p->sumlat;
+      release(&ptable.lock);
+      *lat = copy;
+      return 0;
+    }
+  }
   release(&ptable.lock);
-  return res;
+  return -1;
 }
 
-// wrapper for set_cpu_share()
 int
-sys_set_cpu_share(void)
+sys_getschedlat(void)
 {
-  int share;
-  argint(0, &share);
-  return set_cpu_share(share);
+  struct schedlat *lat;
+  int pid;
+
+  if(argint(0, &pid) < 0 || argptr(1, (void*)&lat, sizeof(*lat)) < 0)
+    return -1;
+  return getschedlat(pid, lat);
+}
+
+int
+sys_sched_setparam(void)
+{
+  struct schedparam *param, copy;
+
+  if(argptr(0, (void*)&param, sizeof(*param)) < 0)
+    return -1;
+  copy = *param;
+  return setparam(&copy);
+}
+
+int
+sys_sched_getparam(void)
+{
+  struct schedparam *param, copy;
+
+  if(argptr(0, (void*)&param, sizeof(*param)) < 0)
+    return -1;
+  getparam(&copy);
+  *param = copy;
+  return 0;
+}
+
+int
+sys_sched_wakeup(void)
+{
+  int policy;
+
+  if(argint(0, &policy) < 0)
+    return -1;
+  return setwakeup(policy);
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -820,6 +1422,48 @@ forkret(void)
 }
 
 
+static struct waitq*
+waitq(void *chan)
+{
+  uint h = (uint)chan;
+
+  return &ptable.waitq[((h >> 2) ^ (h >> 12)) % NWAITQ];
+}
+
+// Append p to the wait queue of p->chan.
+// The ptable lock must be held.
+static void
+wqpush(struct proc *p)
+{
+  struct waitq *wq = waitq(p->chan);
+
+  p->wq = wq;
+  p->wnext = 0;
+  p->wprev = wq->tail;
+  if(wq->tail != 0)
+    wq->tail->wnext = p;
+  else
+    wq->head = p;
+  wq->tail = p;
+}
+
+static void
+wqremove(struct proc *p)
+{
+  struct waitq *wq = p->wq;
+
+  if(p->wprev != 0)
+    p->wprev->wnext = p->wnext;
+  else
+    wq->head = p->wnext;
+  if(p->wnext != 0)
+    p->wnext->wprev = p->wprev;
+  else
+    wq->tail = p->wprev;
+  p->wq = 0;
+  p->wnext = p->wprev = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -847,10 +1491,15 @@ sleep1(void *chan, struct spinlock *lk, int tsleep)
   // Go to sleep.
   p->chan = chan;
   p->state = (tsleep == 0) ? SLEEPING : TSLEEPING;
+  wqpush(p);
+  qupdate(p);
 
   sched();
 
-  // Tidy up.
+  // Tidy up. kill() and thread_unpark() leave p queued, and
+  // so does the scheduler when it runs a TSLEEPING process.
+  if(p->wq != 0)
+    wqremove(p);
   p->chan = 0;
 
   // Reacquire original lock.
@@ -874,23 +1523,33 @@ sleept(void *chan, struct spinlock *lk)
 }
 
 //PAGEBREAK!
-// Wake up all processes sleeping on chan.
+// Wake up at most n processes sleeping on chan, the longest
+// sleeping first. Only the wait queue of chan is scanned.
+// Returns the number of processes woken up.
 // The ptable lock must be held.
-static void
-wakeup1(void *chan)
+static int
+wakeup1(void *chan, int n)
 {
-  struct proc *p;
+  struct proc *p, *next;
+  int woken = 0;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if((p->state == SLEEPING || p->state == TSLEEPING) && p->chan == chan){
+  for(p = waitq(chan)->head; p != 0 && woken < n; p = next){
+    next = p->wnext;
+    if(p->chan != chan)
+      continue;
+    wqremove(p);
+    if(p->state == SLEEPING || p->state == TSLEEPING){
       p->state = RUNNABLE;
-      if(p->state == TSLEEPING)
-        p->chan = 0;
+      p->twake = rdtsc();
+      qupdate(p);
+      woken++;
 #ifdef XEMDEBUG
       if(myproc() != 0)
         cprintf("[wakeup1] (%d) wakeup %d - %d\n", myproc()->pid, chan, p->pid);
 #endif
     }
+  }
+  return woken;
 }
 
 // Wake up all processes sleeping on chan.
@@ -898,10 +1557,33 @@ void
 wakeup(void *chan)
 {
   acquire(&ptable.lock);
-  wakeup1(chan);
+  wakeup1(chan, NPROC);
+  release(&ptable.lock);
+}
+
+// Wake up the process sleeping longest on chan, if any, so
+// that a released resource doesn't wake up every waiter.
+void
+wakeone(void *chan)
+{
+  acquire(&ptable.lock);
+  wakeup1(chan, 1);
   release(&ptable.lock);
 }
 
+// Wake up at most n processes sleeping on chan.
+// Returns the number of processes woken up.
+int
+wakeupn(void *chan, int n)
+{
+  int woken;
+
+  acquire(&ptable.lock);
+  woken = wakeup1(chan, n);
+  release(&ptable.lock);
+  return woken;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -915,8 +1597,11 @@ kill(int pid)
     if(p->pid == pid){
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if(p->state == SLEEPING || p->state == TSLEEPING)
+      if(p->state == SLEEPING || p->state == TSLEEPING){
         p->state = RUNNABLE;
+        p->twake = rdtsc();
+        qupdate(p);
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile int tlbreq;         // If non-zero, flush the TLB and clear it
 };
 
 extern struct cpu cpus[NCPU];
@@ -32,6 +33,20 @@ struct context {
   uint eip;
 };
 
+// A loadable segment of the program, paged in on demand
+struct execseg {
+  uint va;                     // First virtual address
+  uint memsz;                  // Bytes in memory
+  uint off;                    // Offset in the file
+  uint filesz;                 // Bytes in the file; the rest are zero
+};
+
+// Sleepers hashed by channel, in FIFO order
+struct waitq {
+  struct proc *head;
+  struct proc *tail;
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, TSLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -45,27 +60,58 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct waitq *wq;            // If non-zero, wait queue holding the process
+  struct proc *wnext;          // Next sleeper in wq
+  struct proc *wprev;          // Previous sleeper in wq
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exip;          // If non-zero, program of pgdir
+  struct execseg exseg[NEXSEG]; // Segments of the program
+  int nexseg;                  // Number of exseg
   char name[16];               // Process name (debugging)
 
   struct proc *qnext;          // If non-zero, next process in the process list
+  struct proc *qprev;          // If non-zero, previous process in the process list
+  int qin;                     // Which list of the run queue holds the process
 
+  int qcpu;                    // CPU whose run queue holds the process
   int qlev;                    // If non-negative, level of MLFQ
-  int qelpsd;                  // If non-negative, elapsed ticks in the same queue
+  uint64 qelpsd;               // Elapsed cycles in the same queue
+  uint64 qslice;               // Elapsed cycles in the current time quantum
+  uint64 tscin;                // Time stamp counter when switched in
+  uint64 twake;                // If non-zero, time stamp counter when woken
+
+  uint nwake;                  // Wakeups with measured latency
+  uint maxlat;                 // Longest wakeup latency in cycles
+  uint64 sumlat;               // Total wakeup latency in cycles
+  uint qepoch;                 // Boost epoch of the run queue when last touched
 
   int sshr;                    // If positive, shared amount of CPU
-  int spass;                   // If non-negative, total passes in ss
+  uint64 spass;                // Total passes in ss
+  int sidx;                    // Index in the stride heap
+  uint affinity;               // CPUs allowed to run the process
 
   struct proc *oproc;          // If non-zero, origin process
   struct proc *schproc;        // If non-zero, scheduled process
 
-  int schidx;                  // Scheduled index
+  struct proc *thead;          // If non-zero, first LWP of the group
+  struct proc *tnext;          // If non-zero, next LWP in the group
+  struct proc *tprev;          // If non-zero, previous LWP in the group
+  struct proc *tcur;           // If non-zero, LWP last selected by nextlwp()
+  uint lwpmap[NPROC/32];       // Used LWP stack indexes of the group
+  uint lwpcache[NPROC/32];     // Free LWP stack indexes still mapped
+  uint lwpstk[NPROC];          // Stack bottom of each used stack index
+  char *kscache[NKSCACHE];     // Free kernel stacks of the group
+  int nkscache;                // Number of kscache
+  lwpstat_t lwpstat;           // Cache statistics of the group
   int lwpidx;                  // If positive, LWP stack index
+  int permit;                  // If non-zero, the next thread_park() returns
 
   uint hpsz;                   // Heap size
   uint sksz;                   // Stack size
+  uint skguard;                // If non-zero, bottom of the guard beneath sksz
+  uint tlsbase;                // Thread-local storage, selected by %gs
 
   void *retval;                // Return value
 };
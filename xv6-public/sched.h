@@ -0,0 +1,46 @@
+// Scheduler trace events, shared by the kernel and schedstat.
+
+#define SCHEDRING 512     // Events in the ring of each CPU
+
+// Event types
+#define SE_PICK  1        // nextproc() selected the process
+#define SE_RUN   2        // Cycles charged by qdown() (arg)
+#define SE_DOWN  3        // qdown() lowered the level to arg
+#define SE_WAKE  4        // The process became runnable
+#define SE_BOOST 5        // The run queue was boosted to epoch arg
+#define SE_SHARE 6        // setsshr() moved the process to CPU arg
+#define SE_LWP   7        // nextlwp() selected the LWP of pid arg
+
+#define MLFQMAX 8         // Maximum levels of MLFQ
+
+// Scheduler parameters, in ticks unless noted
+struct schedparam {
+  int nlev;               // Levels of MLFQ
+  int qticks[MLFQMAX];    // Time quantum of each level
+  int altmt[MLFQMAX];     // Time allotment of each level but the last
+  int bstprd;             // Boost period
+  int ssticks;            // Time quantum of stride
+  int sharemax;           // Maximum of total CPU share of stride (%)
+  int gtickets;           // Global tickets of stride
+};
+
+// Wakeup policies of MLFQ
+#define WP_NONE    0      // A woken process waits in round robin
+#define WP_PREEMPT 1      // It goes first and preempts lower levels
+
+// Scheduling latency from wakeup to run of a process
+struct schedlat {
+  uint nwake;             // Measured wakeups
+  uint maxlat;            // Longest latency in cycles
+  uint64 sumlat;          // Total latency in cycles
+};
+
+struct schedev {
+  uint64 tsc;             // Time stamp counter of the CPU
+  uchar type;             // One of SE_*
+  uchar cpu;              // CPU which recorded the event
+  char lev;               // MLFQ level, or -1 in stride
+  uchar shr;              // CPU share in stride
+  int pid;                // Process ID, or 0 if none
+  int arg;                // Depends on the type
+};
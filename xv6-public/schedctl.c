@@ -0,0 +1,139 @@
+// Show or change the scheduler parameters.
+// usage: schedctl [name=value ...]
+//   nlev, q<level>, a<level>, bstprd, ssticks, sharemax, gtickets
+//   pin=<pid>,<cpumask> restricts the process to the CPUs
+//   wakeup=none|preempt sets the wakeup policy of MLFQ
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "sched.h"
+
+int
+prefix(char *s, char *pre)
+{
+  while(*pre)
+    if(*s++ != *pre++)
+      return 0;
+  return 1;
+}
+
+// Find the field named by s, which ends at '='.
+int*
+field(struct schedparam *param, char *s)
+{
+  int lev;
+
+  if(prefix(s, "nlev="))
+    return &param->nlev;
+  if(prefix(s, "bstprd="))
+    return &param->bstprd;
+  if(prefix(s, "ssticks="))
+    return &param->ssticks;
+  if(prefix(s, "sharemax="))
+    return &param->sharemax;
+  if(prefix(s, "gtickets="))
+    return &param->gtickets;
+  if((s[0] == 'q' || s[0] == 'a') && s[1] >= '0' && s[1] <= '9'){
+    lev = atoi(s+1);
+    if(lev >= MLFQMAX)
+      return 0;
+    return s[0] == 'q' ? &param->qticks[lev] : &param->altmt[lev];
+  }
+  return 0;
+}
+
+void
+show(struct schedparam *param)
+{
+  int lev;
+
+  printf(1, "nlev=%d bstprd=%d ssticks=%d sharemax=%d gtickets=%d\n",
+         param->nlev, param->bstprd, param->ssticks, param->sharemax,
+         param->gtickets);
+  for(lev = 0; lev < param->nlev; lev++){
+    printf(1, "q%d=%d", lev, param->qticks[lev]);
+    if(lev < param->nlev-1)
+      printf(1, " a%d=%d", lev, param->altmt[lev]);
+    printf(1, "\n");
+  }
+}
+
+// Apply "pin=<pid>,<cpumask>".
+int
+pin(char *s)
+{
+  char *m;
+  int pid;
+
+  if((m = strchr(s, ',')) == 0)
+    return -1;
+  pid = atoi(s);
+  if(set_affinity(pid, atoi(m+1)) < 0)
+    return -1;
+  printf(1, "pid %d pinned to CPUs 0x%x\n", pid, atoi(m+1));
+  return 0;
+}
+
+char *wakeups[] = { "none", "preempt" };
+
+// Apply "wakeup=none" or "wakeup=preempt".
+int
+wakeup(char *s)
+{
+  int policy, old;
+
+  for(policy = WP_NONE; policy <= WP_PREEMPT; policy++)
+    if(strcmp(s, wakeups[policy]) == 0)
+      break;
+  if(policy > WP_PREEMPT || (old = sched_wakeup(policy)) < 0)
+    return -1;
+  printf(1, "wakeup=%s (was %s)\n", wakeups[policy], wakeups[old]);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct schedparam param;
+  char *v;
+  int i, n, *f;
+
+  if(sched_getparam(&param) < 0){
+    printf(2, "schedctl: cannot get parameters\n");
+    exit();
+  }
+
+  n = 0;
+  for(i = 1; i < argc; i++){
+    if(prefix(argv[i], "pin=")){
+      if(pin(argv[i]+4) < 0){
+        printf(2, "schedctl: cannot pin %s\n", argv[i]+4);
+        exit();
+      }
+      continue;
+    }
+    if(prefix(argv[i], "wakeup=")){
+      if(wakeup(argv[i]+7) < 0){
+        printf(2, "schedctl: unknown wakeup policy %s\n", argv[i]+7);
+        exit();
+      }
+      continue;
+    }
+    n++;
+    if((f = field(&param, argv[i])) == 0 || (v = strchr(argv[i], '=')) == 0){
+      printf(2, "schedctl: unknown parameter %s\n", argv[i]);
+      exit();
+    }
+    *f = atoi(v+1);
+  }
+
+  if(n > 0 && sched_setparam(&param) < 0){
+    printf(2, "schedctl: invalid parameters\n");
+    exit();
+  }
+
+  sched_getparam(&param);
+  show(&param);
+  exit();
+}
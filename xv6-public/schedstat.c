@@ -0,0 +1,233 @@
+// Trace the scheduler for a while and summarize the events.
+// usage: schedstat [ticks [command args...]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "sched.h"
+
+#define NEV    (NCPU*SCHEDRING)  // Events drained at once
+#define NPSTAT 64                 // Processes tracked
+#define NBUCKET 40                // Buckets of the latency histogram
+
+struct pstat {
+  int pid;
+  int shr;                    // Last CPU share in stride
+  int cpu;                    // Last CPU
+  uint64 wake;                // When it became runnable, or 0
+  uint64 cycles;              // Cycles charged
+  struct schedlat lat;        // From getschedlat() at the end
+};
+
+struct schedev ev[NEV];
+struct pstat ps[NPSTAT];
+uint64 cpucycles[NCPU];
+uint64 levcycles[MLFQMAX+1];  // MLFQ levels and stride
+uint hist[NBUCKET];
+uint count[SE_LWP+1];         // By event type
+
+struct pstat*
+lookup(int pid)
+{
+  struct pstat *s, *free = 0;
+
+  for(s = ps; s < &ps[NPSTAT]; s++){
+    if(s->pid == pid)
+      return s;
+    if(s->pid == 0 && free == 0)
+      free = s;
+  }
+  if(free != 0)
+    free->pid = pid;
+  return free;
+}
+
+int
+log2(uint64 v)
+{
+  int k = 0;
+
+  while(v >>= 1)
+    k++;
+  return k;
+}
+
+// a*100/b without 64-bit division.
+uint
+pct(uint64 a, uint64 b)
+{
+  while(b >= (1 << 24)){
+    a >>= 1;
+    b >>= 1;
+  }
+  if(b == 0)
+    return 0;
+  return (uint)a * 100 / (uint)b;
+}
+
+// sum/n without 64-bit division.
+uint
+mean(uint64 sum, uint n)
+{
+  while(sum > 0xffffffff){
+    sum >>= 1;
+    n >>= 1;
+  }
+  if(n == 0)
+    return 0;
+  return (uint)sum / n;
+}
+
+// Events of different CPUs are drained one ring after
+// another, so put them back in time order.
+void
+sort(int n)
+{
+  struct schedev e;
+  int i, j;
+
+  for(i = 1; i < n; i++){
+    e = ev[i];
+    for(j = i; j > 0 && ev[j-1].tsc > e.tsc; j--)
+      ev[j] = ev[j-1];
+    ev[j] = e;
+  }
+}
+
+void
+account(struct schedev *e)
+{
+  struct pstat *s = 0;
+  int k;
+
+  // The CPU indexes cpucycles, so don't trust it.
+  if(e->cpu >= NCPU)
+    return;
+  if(e->type <= SE_LWP)
+    count[e->type]++;
+  if(e->pid != 0 && (s = lookup(e->pid)) == 0)
+    return;
+
+  switch(e->type){
+  case SE_WAKE:
+    s->wake = e->tsc;
+    break;
+  case SE_PICK:
+    if(s->wake != 0 && e->tsc >= s->wake){
+      k = log2(e->tsc - s->wake);
+      hist[k < NBUCKET ? k : NBUCKET-1]++;
+    }
+    s->wake = 0;
+    break;
+  case SE_RUN:
+    s->cycles += (uint)e->arg;
+    s->shr = e->shr;
+    s->cpu = e->cpu;
+    cpucycles[e->cpu] += (uint)e->arg;
+    levcycles[e->lev >= 0 ? e->lev : MLFQMAX] += (uint)e->arg;
+    break;
+  }
+}
+
+void
+drain(void)
+{
+  int i, n;
+
+  while((n = sched_drain(ev, NEV)) > 0){
+    sort(n);
+    for(i = 0; i < n; i++)
+      account(&ev[i]);
+  }
+}
+
+// Take the wakeup latency the kernel measured for each traced
+// process, before the command is waited for.
+void
+latency(void)
+{
+  struct pstat *s;
+
+  for(s = ps; s < &ps[NPSTAT]; s++)
+    if(s->pid == 0 || getschedlat(s->pid, &s->lat) < 0)
+      s->lat.nwake = 0;
+}
+
+void
+report(int dropped)
+{
+  struct pstat *s;
+  struct schedparam param;
+  uint64 total = 0;
+  int k;
+
+  printf(1, "events: pick %d run %d down %d wake %d boost %d share %d lwp %d"
+         " dropped %d\n", count[SE_PICK], count[SE_RUN], count[SE_DOWN],
+         count[SE_WAKE], count[SE_BOOST], count[SE_SHARE], count[SE_LWP],
+         dropped);
+
+  printf(1, "wakeup latency (cycles):\n");
+  for(k = 0; k < NBUCKET; k++)
+    if(hist[k] != 0)
+      printf(1, "  2^%d\t%d\n", k, hist[k]);
+
+  printf(1, "wakeup latency by process (pid count mean max cycles):\n");
+  for(s = ps; s < &ps[NPSTAT]; s++)
+    if(s->pid != 0 && s->lat.nwake != 0)
+      printf(1, "  %d\t%d\t%d\t%d\n", s->pid, s->lat.nwake,
+             mean(s->lat.sumlat, s->lat.nwake), s->lat.maxlat);
+
+  for(k = 0; k <= MLFQMAX; k++)
+    total += levcycles[k];
+  param.nlev = MLFQMAX;
+  sched_getparam(&param);
+  printf(1, "residency:");
+  for(k = 0; k < param.nlev; k++)
+    printf(1, " L%d %d%%", k, pct(levcycles[k], total));
+  printf(1, " stride %d%%\n", pct(levcycles[MLFQMAX], total));
+
+  printf(1, "stride share (pid cpu share actual):\n");
+  for(s = ps; s < &ps[NPSTAT]; s++)
+    if(s->pid != 0 && s->shr != 0)
+      printf(1, "  %d\t%d\t%d%%\t%d%%\n", s->pid, s->cpu, s->shr,
+             pct(s->cycles, cpucycles[s->cpu]));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ticks = 100, start, pid = 0, dropped;
+
+  if(argc > 1)
+    ticks = atoi(argv[1]);
+
+  dropped = sched_trace(1);
+  if(argc > 2){
+    pid = fork();
+    if(pid < 0){
+      printf(2, "schedstat: fork failed\n");
+      sched_trace(0);
+      exit();
+    }
+    if(pid == 0){
+      exec(argv[2], argv+2);
+      printf(2, "schedstat: exec %s failed\n", argv[2]);
+      exit();
+    }
+  }
+
+  start = uptime();
+  while(uptime() - start < ticks){
+    sleep(1);
+    drain();
+  }
+  latency();
+  if(pid > 0)
+    wait();
+
+  dropped = sched_trace(0) - dropped;
+  drain();
+  report(dropped);
+  exit();
+}
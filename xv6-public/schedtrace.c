@@ -0,0 +1,133 @@
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sched.h"
+
+// Single-producer ring of a CPU. Only the CPU itself writes
+// events with interrupts off, so it needs no lock; readers
+// are serialized by schedtrace.lock.
+struct schedring {
+  struct schedev ev[SCHEDRING];
+  uint head;              // Written by the CPU
+  uint tail;              // Written by readers
+  uint dropped;           // Events lost while the ring was full
+};
+
+struct {
+  struct spinlock lock;
+  struct schedring ring[NCPU];
+} schedtrace;
+
+int schedtracing;
+
+void
+schedtraceinit(void)
+{
+  initlock(&schedtrace.lock, "schedtrace");
+}
+
+// Record an event on the ring of this CPU.
+void
+schedev(int type, struct proc *p, int arg)
+{
+  struct schedring *r;
+  struct schedev *e;
+
+  if(!schedtracing)
+    return;
+
+  pushcli();
+  r = &schedtrace.ring[cpuid()];
+  if(r->head - r->tail >= SCHEDRING){
+    r->dropped++;
+    popcli();
+    return;
+  }
+
+  e = &r->ev[r->head % SCHEDRING];
+  e->tsc = rdtsc();
+  e->type = type;
+  e->cpu = r - schedtrace.ring;
+  e->lev = p ? p->qlev : 0;
+  e->shr = p ? p->sshr : 0;
+  e->pid = p ? p->pid : 0;
+  e->arg = arg;
+
+  // Publish the event after it is written.
+  __sync_synchronize();
+  r->head++;
+  popcli();
+}
+
+// Turn tracing on or off. Returns the number of events
+// dropped so far.
+int
+sched_trace(int on)
+{
+  struct schedring *r;
+  int dropped = 0;
+
+  acquire(&schedtrace.lock);
+  if(on && !schedtracing){
+    // Discard stale events.
+    for(r = schedtrace.ring; r < &schedtrace.ring[ncpu]; r++)
+      r->tail = r->head;
+  }
+  schedtracing = on;
+  for(r = schedtrace.ring; r < &schedtrace.ring[ncpu]; r++)
+    dropped += r->dropped;
+  release(&schedtrace.lock);
+
+  return dropped;
+}
+
+// Move up to n events into buf, CPU by CPU.
+int
+sched_drain(struct schedev *buf, int n)
+{
+  struct schedring *r;
+  uint head;
+  int i = 0;
+
+  acquire(&schedtrace.lock);
+  for(r = schedtrace.ring; r < &schedtrace.ring[ncpu] && i < n; r++){
+    head = r->head;
+    __sync_synchronize();
+    while(r->tail != head && i < n){
+      buf[i++] = r->ev[r->tail % SCHEDRING];
+      // Free the slot only after it is read.
+      __sync_synchronize();
+      r->tail++;
+    }
+  }
+  release(&schedtrace.lock);
+
+  return i;
+}
+
+int
+sys_sched_trace(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  return sched_trace(on);
+}
+
+int
+sys_sched_drain(void)
+{
+  struct schedev *buf;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(argptr(0, (void*)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  return sched_drain(buf, n);
+}
@@ -2,54 +2,345 @@
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
+#include "x86.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sched.h"
 
+// Defaults of the parameters. Each lower level of MLFQ doubles
+// the time quantum and the time allotment of the upper one.
+#define NLEV 3            // Levels of MLFQ
 #define Q0TICKS 5         // Ticks of queue 0
-#define Q1TICKS 10        // Ticks of queue 1
-#define Q2TICKS 20        // Ticks of queue 2
 #define SSTICKS 5         // Ticks of stride
 
 #define Q0ALTMT 20        // Time allotment of queue 0
-#define Q1ALTMT 40        // Time allotment of queue 1
 
 #define BSTPRD 200        // Boost period
 
 #define SHAREMAX 80       // Maximum of CPU share of ss
 #define GTICKETS 10000    // Global tickets of ss
 
-struct {
-  struct proc *queue[3];  // Priority Queues
+#define TSCTICK 10000000  // Cycles per tick until calibrated
+
+// Which list holds a process (proc.qin)
+#define QNONE 0           // Not queued
+#define QRUN  1           // Runnable list (or stride heap)
+#define QBLK  2           // Blocked list
+
+// Doubly-linked process list through proc.qnext and proc.qprev
+struct qlist {
+  struct proc *head;
+  struct proc *tail;
+};
+
+// Current parameters. Changed only while holding the locks of
+// all run queues, so holding any of them is enough to read.
+static struct schedparam sparam;
+
+// How a woken process of MLFQ is placed
+static int wakepolicy = WP_PREEMPT;
+
+// Cycles per tick, calibrated by tsccalib(). A uint so that
+// other CPUs read it at once.
+static uint tsctick = TSCTICK;
+
+struct mlfq {
+  struct qlist run[MLFQMAX]; // Runnable processes of each level
+  struct qlist blk[MLFQMAX]; // Blocked processes of each level
+  uint bitmap;            // Levels which have runnable processes
+  uint epoch;             // Number of boosts so far
   struct proc *lastproc;  // Last executed process
   int lastpid;            // Last executed process ID
-} mlfq;
+  int preempt;            // A woken process preempts lastproc
+};
 
-struct {
-  struct proc *queue;     // Process queue
+struct stride {
+  struct proc *heap[NPROC]; // Min-heap of runnable processes by passes
+  int nheap;              // Number of processes in the heap
+  struct qlist blk;       // Blocked processes
   int shares;             // Total shares
-  int mlfqpass;           // Passes of MLFQ
+  uint64 mlfqpass;        // Passes of MLFQ
   struct proc *lastproc;  // Last executed process
   int lastpid;            // Last executed process ID
-} stride;
+};
+
+// Per-CPU run queue. Each CPU schedules only from its own
+// queues, so the selection doesn't need ptable.lock.
+// Lock order: ptable.lock, then rq.lock (lower index first).
+struct rq {
+  struct spinlock lock;
+  struct mlfq mlfq;
+  struct stride stride;
+  int nrun;               // Number of runnable processes in MLFQ
+  uint balticks;          // Ticks of the last balancing
+  uint mlfqticks;         // Ticks of this CPU running MLFQ
+};
+
+struct rq rqs[NCPU];
 
-int
-qmove(struct proc *p, int level)
+void
+rqinit(void)
 {
-  if(p->qlev < 0)
-    return -1;
+  struct rq *rq;
+  int lev;
+
+  for(rq = rqs; rq < &rqs[NCPU]; rq++)
+    initlock(&rq->lock, "rq");
+
+  sparam.nlev = NLEV;
+  for(lev = 0; lev < MLFQMAX; lev++){
+    sparam.qticks[lev] = Q0TICKS << lev;
+    sparam.altmt[lev] = Q0ALTMT << lev;
+  }
+  sparam.bstprd = BSTPRD;
+  sparam.ssticks = SSTICKS;
+  sparam.sharemax = SHAREMAX;
+  sparam.gtickets = GTICKETS;
+}
+
+// Lock the run queue which p belongs to.
+// p->qcpu is re-checked because a balancer may migrate p.
+static struct rq*
+rqlock(struct proc *p)
+{
+  struct rq *rq;
+
+  for(;;){
+    rq = &rqs[p->qcpu];
+    acquire(&rq->lock);
+    if(rq == &rqs[p->qcpu])
+      return rq;
+    release(&rq->lock);
+  }
+}
 
-  struct proc *ptr = mlfq.queue[level];
-  if(ptr == 0){
-    mlfq.queue[level] = p;
+// Lock two run queues in the order of their index.
+static void
+rqlock2(struct rq *a, struct rq *b)
+{
+  if(a == b){
+    acquire(&a->lock);
+  }else if(a < b){
+    acquire(&a->lock);
+    acquire(&b->lock);
   }else{
-    for(;ptr->qnext != 0;){
-      ptr = ptr->qnext;
-    }
-    ptr->qnext = p;
+    acquire(&b->lock);
+    acquire(&a->lock);
   }
+}
 
-  p->qlev = level;
+static void
+rqunlock2(struct rq *a, struct rq *b)
+{
+  release(&a->lock);
+  if(a != b)
+    release(&b->lock);
+}
+
+static void
+qappend(struct qlist *q, struct proc *p)
+{
   p->qnext = 0;
+  p->qprev = q->tail;
+  if(q->tail == 0)
+    q->head = p;
+  else
+    q->tail->qnext = p;
+  q->tail = p;
+}
+
+static void
+qunlink(struct qlist *q, struct proc *p)
+{
+  if(p->qprev == 0)
+    q->head = p->qnext;
+  else
+    p->qprev->qnext = p->qnext;
+
+  if(p->qnext == 0)
+    q->tail = p->qprev;
+  else
+    p->qnext->qprev = p->qprev;
+
+  p->qnext = 0;
+  p->qprev = 0;
+}
+
+static void
+qprepend(struct qlist *q, struct proc *p)
+{
+  p->qprev = 0;
+  p->qnext = q->head;
+  if(q->head == 0)
+    q->tail = p;
+  else
+    q->head->qprev = p;
+  q->head = p;
+}
+
+// Move all processes of src to the tail of dst.
+static void
+qsplice(struct qlist *dst, struct qlist *src)
+{
+  if(src->head == 0)
+    return;
+
+  if(dst->tail == 0){
+    dst->head = src->head;
+  }else{
+    dst->tail->qnext = src->head;
+    src->head->qprev = dst->tail;
+  }
+  dst->tail = src->tail;
+  src->head = 0;
+  src->tail = 0;
+}
+
+// Binary min-heap of stride processes keyed by proc.spass.
+// proc.sidx is the index of the process in the heap.
+static void
+hswap(struct stride *st, int i, int j)
+{
+  struct proc *p = st->heap[i];
+
+  st->heap[i] = st->heap[j];
+  st->heap[j] = p;
+  st->heap[i]->sidx = i;
+  st->heap[j]->sidx = j;
+}
+
+static void
+hup(struct stride *st, int i)
+{
+  int parent;
+
+  for(; i > 0; i = parent){
+    parent = (i-1) / 2;
+    if(st->heap[parent]->spass <= st->heap[i]->spass)
+      break;
+    hswap(st, i, parent);
+  }
+}
+
+static void
+hdown(struct stride *st, int i)
+{
+  int child;
+
+  for(; (child = 2*i+1) < st->nheap; i = child){
+    if(child+1 < st->nheap &&
+        st->heap[child+1]->spass < st->heap[child]->spass)
+      child++;
+    if(st->heap[i]->spass <= st->heap[child]->spass)
+      break;
+    hswap(st, i, child);
+  }
+}
+
+static void
+hpush(struct stride *st, struct proc *p)
+{
+  p->sidx = st->nheap++;
+  st->heap[p->sidx] = p;
+  hup(st, p->sidx);
+}
+
+static void
+hremove(struct stride *st, struct proc *p)
+{
+  int i = p->sidx;
+
+  st->nheap--;
+  if(i != st->nheap){
+    hswap(st, i, st->nheap);
+    hup(st, i);
+    hdown(st, i);
+  }
+  st->heap[st->nheap] = 0;
+  p->sidx = -1;
+}
+
+// Global virtual time of the stride queue, which is the
+// minimum pass among the runnable processes and MLFQ.
+static uint64
+minpass(struct rq *rq)
+{
+  struct stride *st = &rq->stride;
+
+  if(st->nheap > 0 && st->heap[0]->spass < st->mlfqpass)
+    return st->heap[0]->spass;
+  return st->mlfqpass;
+}
+
+// A blocked stride process keeps only the passes ahead of the
+// virtual time, so it neither monopolizes the CPU after a long
+// sleep nor loses its place.
+static void
+sblock(struct rq *rq, struct proc *p)
+{
+  uint64 vtime;
+
+  hremove(&rq->stride, p);
+  vtime = minpass(rq);
+  p->spass = (p->spass > vtime) ? p->spass - vtime : 0;
+  qappend(&rq->stride.blk, p);
+}
+
+static void
+sunblock(struct rq *rq, struct proc *p)
+{
+  qunlink(&rq->stride.blk, p);
+  p->spass += minpass(rq);
+  hpush(&rq->stride, p);
+}
+
+// Whether the process stays in the runnable list.
+// A running one is kept so that it needs nothing when it yields.
+static int
+qactive(struct proc *p)
+{
+  return p->state == RUNNABLE || p->state == TSLEEPING ||
+    p->state == RUNNING;
+}
+
+// Whether the process can be selected to run.
+static int
+qrunnable(struct proc *p)
+{
+  return p->state == RUNNABLE || p->state == TSLEEPING;
+}
+
+// Apply the boosts which p has missed. qboost1() has already
+// spliced the lists, so only the fields of p are out of date.
+static void
+qsync(struct rq *rq, struct proc *p)
+{
+  if(p->qlev >= 0 && p->qepoch != rq->mlfq.epoch){
+    p->qlev = 0;
+    p->qelpsd = 0;
+    p->qslice = 0;
+    p->qepoch = rq->mlfq.epoch;
+  }
+}
+
+// Append p into the MLFQ list of the given level.
+static int
+qmove(struct rq *rq, struct proc *p, int level)
+{
+  if(p->qlev < 0)
+    return -1;
+
+  p->qlev = level;
   p->qelpsd = 0;
+  p->qepoch = rq->mlfq.epoch;
+
+  if(p->qin == QRUN){
+    qappend(&rq->mlfq.run[level], p);
+    rq->mlfq.bitmap |= (1 << level);
+    rq->nrun++;
+  }else{
+    qappend(&rq->mlfq.blk[level], p);
+  }
 
 #ifdef SCHDEBUG
     cprintf("qmove %p %d\n", p, level);
@@ -58,68 +349,180 @@ qmove(struct proc *p, int level)
   return 0;
 }
 
+// Unlink p from the MLFQ list which holds it.
+static void
+qunmove(struct rq *rq, struct proc *p)
+{
+  int lev;
+
+  qsync(rq, p);
+  lev = p->qlev;
+
+  if(p->qin == QRUN){
+    qunlink(&rq->mlfq.run[lev], p);
+    if(rq->mlfq.run[lev].head == 0)
+      rq->mlfq.bitmap &= ~(1 << lev);
+    rq->nrun--;
+  }else{
+    qunlink(&rq->mlfq.blk[lev], p);
+  }
+}
+
+// Both MLFQ and Stride are accepted.
+static int
+qremove(struct rq *rq, struct proc *p)
+{
+  if(p->qlev >= 0){
+    qunmove(rq, p);
+  }else{
+    if(p->qin == QRUN)
+      hremove(&rq->stride, p);
+    else
+      qunlink(&rq->stride.blk, p);
+    rq->stride.shares -= p->sshr;
+    p->sshr = 0;
+  }
+
+  if(rq->mlfq.lastproc == p)
+    rq->mlfq.lastproc = 0;
+  if(rq->stride.lastproc == p)
+    rq->stride.lastproc = 0;
+
+#ifdef SCHDEBUG
+    cprintf("qremove %p\n", p);
+#endif
+  return 0;
+}
+
+// Enqueue a new process into the least loaded run queue.
+// The caller is about to make it RUNNABLE.
 int
 qpush(struct proc *p)
 {
+  struct rq *rq, *ptr;
+
+  rq = 0;
+  for(ptr = rqs; ptr < &rqs[ncpu]; ptr++)
+    if((p->affinity & (1 << (ptr - rqs))) && (rq == 0 || ptr->nrun < rq->nrun))
+      rq = ptr;
+  if(rq == 0)
+    rq = &rqs[0];
+
+  acquire(&rq->lock);
+  p->qcpu = rq - rqs;
   p->qlev = 0;
+  p->qslice = 0;
+  p->qin = QRUN;
   p->sshr = 0;
+  qmove(rq, p, 0);
+  release(&rq->lock);
 
 #ifdef SCHDEBUG
-    cprintf("qpush %p\n", p);
+    cprintf("qpush %p %d\n", p, p->qcpu);
 #endif
 
-  return qmove(p, 0);
+  return 0;
 }
 
-// Both MLFQ and Stride are accepted.
 int
 qpop(struct proc *p)
 {
-  struct proc **qhead = (p->qlev >= 0) ?
-    &mlfq.queue[p->qlev] : &stride.queue;
+  struct rq *rq = rqlock(p);
+  qremove(rq, p);
+  p->qin = QNONE;
+  release(&rq->lock);
+  return 0;
+}
 
-  struct proc *ptr = *qhead; 
-  if(p == *qhead){
-    *qhead = p->qnext;
-  }else{
-    for(;p != ptr->qnext;)
-      ptr = ptr->qnext;
-    
-    ptr->qnext = p->qnext;
-  }
+// Level of p, including the boosts not applied yet.
+int
+qlevel(struct proc *p)
+{
+  if(p->qlev > 0 && p->qepoch != rqs[p->qcpu].mlfq.epoch)
+    return 0;
+  return p->qlev;
+}
 
-  if(p->qlev < 0){
-    stride.shares -= p->sshr;
-    p->sshr = 0;
+// Put a woken process of MLFQ first in its level. It preempts
+// the running process of the same or a lower level, which is
+// checked in nextmlfq() at the next tick.
+static void
+qwake(struct rq *rq, struct proc *p)
+{
+  struct mlfq *mlfq = &rq->mlfq;
+  struct proc *last = mlfq->lastproc;
+
+  qunlink(&mlfq->run[p->qlev], p);
+  qprepend(&mlfq->run[p->qlev], p);
+
+  if(last != 0 && last->pid == mlfq->lastpid && last->state == RUNNING){
+    qsync(rq, last);
+    if(last->qlev >= p->qlev)
+      mlfq->preempt = 1;
   }
+}
 
-#ifdef SCHDEBUG
-    cprintf("qpop %p\n", p);
-#endif
-  return 0;
+// Move p between the runnable and blocked lists after its
+// state has changed. ptable.lock must be held.
+void
+qupdate(struct proc *p)
+{
+  struct rq *rq;
+  uint64 elpsd;
+  int in;
+
+  if(p->qin == QNONE)
+    return;
+
+  rq = rqlock(p);
+  in = qactive(p) ? QRUN : QBLK;
+  if(in == QRUN && p->qin == QBLK)
+    schedev(SE_WAKE, p, 0);
+  if(p->qin != in && p->qlev >= 0){
+    qunmove(rq, p);
+    p->qin = in;
+    // Keep the elapsed cycles across the move.
+    elpsd = p->qelpsd;
+    qmove(rq, p, p->qlev);
+    p->qelpsd = elpsd;
+    if(in == QRUN && wakepolicy == WP_PREEMPT)
+      qwake(rq, p);
+  }else if(p->qin != in){
+    if(in == QRUN)
+      sunblock(rq, p);
+    else
+      sblock(rq, p);
+    p->qin = in;
+  }
+  release(&rq->lock);
 }
 
-int
+static int
 altmt(struct proc *p)
 {
-  switch(p->qlev){
-  case 0:
-    return Q0ALTMT;
-  case 1:
-    return Q1ALTMT;
-  default:
+  if(p->qlev < 0 || p->qlev >= sparam.nlev-1)
     return -1;
-  }
+  return sparam.altmt[p->qlev];
 }
 
-int
-qdown(struct proc *p)
+// Whether the cycles have reached the given ticks,
+// rounded to the nearest tick.
+static int
+expired(uint64 cycles, int nticks)
+{
+  return cycles + tsctick/2 >= (uint64)nticks * tsctick;
+}
+
+static int
+qdown1(struct rq *rq, struct proc *p)
 {
-  if(p->qlev == 2 || p->qelpsd <= altmt(p))
+  if(p->qlev < 0 || p->qlev >= sparam.nlev-1 || !expired(p->qelpsd, altmt(p)))
     return 1;
 
-  qpop(p);
-  qmove(p, p->qlev+1);
+  qunmove(rq, p);
+  qmove(rq, p, p->qlev+1);
+  p->qslice = 0;
+  schedev(SE_DOWN, p, p->qlev);
 
 #ifdef SCHDEBUG
     cprintf("qdown %p %d\n", p, p->qlev);
@@ -128,179 +531,483 @@ qdown(struct proc *p)
   return 0;
 }
 
+// Charge cycles to p and lower its level if the allotment is used up.
 int
-timeqt(struct proc *p)
+qdown(struct proc *p, uint64 cycles)
 {
-  switch(p->qlev){
-  case 0:
-    return Q0TICKS;
-  case 1:
-    return Q1TICKS;
-  case 2:
-    return Q2TICKS;
-  default:
-    return -1;
+  struct rq *rq = rqlock(p);
+  int res = 1;
+
+  if(p->qin == QNONE){
+    release(&rq->lock);
+    return res;
   }
+
+  qsync(rq, p);
+  p->qelpsd += cycles;
+  p->qslice += cycles;
+  schedev(SE_RUN, p, (uint)cycles);
+  res = qdown1(rq, p);
+  release(&rq->lock);
+  return res;
 }
 
-struct proc*
-nextmlfq(void)
+static int
+timeqt(struct proc *p)
 {
-  int prevlev = -1;
-  if(mlfq.lastproc != 0 && mlfq.lastproc->pid == mlfq.lastpid){
-    // Return the last process which hasn't ended up
-    if((mlfq.lastproc->qelpsd % timeqt(mlfq.lastproc)) > 0 &&
-        (mlfq.lastproc->state == RUNNABLE || mlfq.lastproc->state == TSLEEPING)){
-      return mlfq.lastproc;
-    }
-
-    prevlev = mlfq.lastproc->qlev;
-  }
+  if(p->qlev < 0 || p->qlev >= sparam.nlev)
+    return -1;
+  return sparam.qticks[p->qlev];
+}
 
-  struct proc *p = 0;
+static struct proc*
+nextmlfq(struct rq *rq)
+{
+  struct mlfq *mlfq = &rq->mlfq;
+  struct proc *p = mlfq->lastproc;
+  uint bitmap;
   int lev;
 
-  for(lev=0; lev<3; lev++){
-    if(mlfq.queue[lev] == 0)
-      continue;
-    
-    p = mlfq.queue[lev];
-    for(;p != 0 && (p->state != RUNNABLE && p->state != TSLEEPING);)
-      p = p->qnext;
-
-    if(p == 0)
-      continue;
-
-    // When the process is found at the same level.
-    if(lev == prevlev && p->pid == mlfq.lastpid){
-      // Search for the next runnable process.
-      for(;p != 0 && (p->state != RUNNABLE && p->state != TSLEEPING);)
-        p = p->qnext;
+  if(p != 0 && p->pid == mlfq->lastpid && p->qlev >= 0){
+    qsync(rq, p);
 
-      // If not found, run the previous one.
-      if(p == 0)
-        p = mlfq.lastproc;
+    if(!expired(p->qslice, timeqt(p)) && qrunnable(p)){
+      // Return the last process which hasn't ended up, unless
+      // a woken process preempts it. Then it keeps its place
+      // and the rest of its time quantum.
+      if(!mlfq->preempt)
+        return p;
+    }else{
+      // Round robin: its time quantum is over.
+      p->qslice = 0;
+      if(p->qin == QRUN && p != mlfq->run[p->qlev].tail){
+        qunlink(&mlfq->run[p->qlev], p);
+        qappend(&mlfq->run[p->qlev], p);
+      }
     }
-
-    break;
+  }
+  mlfq->preempt = 0;
+
+  // Running processes stay in the lists, but there are at
+  // most NCPU of them to skip.
+  p = 0;
+  for(bitmap = mlfq->bitmap; bitmap != 0 && p == 0; bitmap &= ~(1 << lev)){
+    lev = bsf(bitmap);
+    for(p = mlfq->run[lev].head; p != 0 && !qrunnable(p); p = p->qnext)
+      ;
   }
 
   if(p == 0)
     return 0;
 
-  mlfq.lastproc = p;
-  mlfq.lastpid = p->pid;
+  qsync(rq, p);
+  if(expired(p->qslice, timeqt(p)))
+    p->qslice = 0;
+  mlfq->lastproc = p;
+  mlfq->lastpid = p->pid;
 
 #ifdef SCHDEBUG
-    cprintf("nextmlfq %d %d %d\n", p->pid, p->qlev, p->qelpsd);
+    cprintf("nextmlfq %d %d %d\n", p->pid, p->qlev, (uint)p->qelpsd);
 #endif
 
   return p;
 }
 
-struct proc*
-nextproc(void)
+static struct proc*
+nextproc1(struct rq *rq)
 {
+  struct stride *stride = &rq->stride;
   struct proc *p = 0, *ptr;
 
-  if(stride.lastproc != 0 && stride.lastproc->pid == stride.lastpid &&
-      (stride.lastproc->qelpsd % SSTICKS) > 0 &&
-      (stride.lastproc->state == RUNNABLE || stride.lastproc->state == TSLEEPING)){
+  if(stride->lastproc != 0 && stride->lastproc->pid == stride->lastpid &&
+      !expired(stride->lastproc->qslice, sparam.ssticks) &&
+      qrunnable(stride->lastproc)){
     // Return the last process which hasn't ended up
-    p = stride.lastproc;
+    return stride->lastproc;
+  }
 
-  }else{
-    // Traverse stride queue and find the minimum passes.
-    ptr = stride.queue;
-    for(;ptr != 0;){
-      if((ptr->state == RUNNABLE || ptr->state == TSLEEPING)
-           && (p == 0 || ptr->spass < p->spass))
-        p = ptr;
-
-      ptr = ptr->qnext;
+  // The minimum passes are on the top of the heap. It can be a
+  // process still running on another CPU after setsshr().
+  if(stride->nheap > 0 && qrunnable(stride->heap[0]))
+    p = stride->heap[0];
+
+  if(p == 0 || stride->mlfqpass <= p->spass){
+    // Find from MLFQ
+    ptr = nextmlfq(rq);
+    if(ptr != 0){
+      stride->mlfqpass += (sparam.gtickets / (100-stride->shares));
+      return ptr;
     }
+    if(p == 0)
+      return 0;
 
-    if(p != 0 && stride.mlfqpass > p->spass){
-      // Select from stride
-      p->spass += (GTICKETS / p->sshr);
-
-      stride.lastproc = p;
-      stride.lastpid = p->pid;
-    }else{
-      // Find from MLFQ
-      ptr = nextmlfq();
-      if(ptr != 0){
-        p = ptr;
-        stride.mlfqpass += (GTICKETS / (100-stride.shares));
-      }
-    }
+    // An idle MLFQ doesn't save up passes.
+    stride->mlfqpass = p->spass;
   }
 
+  // Select from stride
+  p->spass += (sparam.gtickets / p->sshr);
+  hdown(stride, 0);
+
+  p->qslice = 0;
+  stride->lastproc = p;
+  stride->lastpid = p->pid;
+
   return p;
 }
 
-//ptable lock is required.
+// Select the next process from the run queue of the given CPU.
+// The caller must re-check the state under ptable.lock,
+// because the queues are scanned without it.
+struct proc*
+nextproc(int cpu)
+{
+  struct rq *rq = &rqs[cpu];
+  struct proc *p;
+
+  acquire(&rq->lock);
+  p = nextproc1(rq);
+  if(p != 0)
+    schedev(SE_PICK, p, 0);
+  release(&rq->lock);
+
+  return p;
+}
+
+// Move p from src to dst. Both must be locked.
+static void
+qmigrate(struct rq *src, struct rq *dst, struct proc *p)
+{
+  uint64 elpsd = p->qelpsd, vtime;
+  int shr = p->sshr;
+
+  if(p->qlev >= 0){
+    qremove(src, p);
+    p->qcpu = dst - rqs;
+    qmove(dst, p, p->qlev);
+    p->qelpsd = elpsd;
+    return;
+  }
+
+  // Keep only the lead over the virtual time, like sblock().
+  vtime = minpass(src);
+  qremove(src, p);
+  p->qcpu = dst - rqs;
+  p->sshr = shr;
+  if(p->qin == QRUN){
+    p->spass = (p->spass > vtime) ? p->spass - vtime : 0;
+    p->spass += minpass(dst);
+    hpush(&dst->stride, p);
+  }else{
+    qappend(&dst->stride.blk, p);
+  }
+  dst->stride.shares += shr;
+}
+
+// Pull a runnable MLFQ process from the busiest run queue
+// into the run queue of the given CPU. Called when it is idle.
 void
-qboost(int mlfqticks)
+qbalance(int cpu)
 {
-  if(mlfqticks % BSTPRD != 0)
+  struct rq *rq = &rqs[cpu], *src = 0, *ptr;
+  struct proc *p;
+  uint bitmap;
+  int lev;
+
+  // Balance at most once per tick.
+  if(rq->balticks == ticks)
+    return;
+  rq->balticks = ticks;
+
+  for(ptr = rqs; ptr < &rqs[ncpu]; ptr++)
+    if(ptr != rq && ptr->nrun > 1 && (src == 0 || ptr->nrun > src->nrun))
+      src = ptr;
+
+  if(src == 0 || src->nrun <= rq->nrun + 1)
     return;
-  
+
+  rqlock2(src, rq);
+
+  // Prefer the least favored level, since it is the least
+  // likely to be selected by the busy CPU.
+  p = 0;
+  for(bitmap = src->mlfq.bitmap; bitmap != 0 && p == 0; bitmap &= ~(1 << lev)){
+    lev = bsr(bitmap);
+    for(p = src->mlfq.run[lev].tail; p != 0; p = p->qprev)
+      if(p->state == RUNNABLE && p != src->mlfq.lastproc &&
+          (p->affinity & (1 << cpu)))
+        break;
+  }
+
+  if(p != 0){
+    qmigrate(src, rq, p);
+
 #ifdef SCHDEBUG
-    cprintf("boost start\n");
+    cprintf("qbalance %p %d -> %d\n", p, src - rqs, cpu);
 #endif
+  }
+
+  rqunlock2(src, rq);
+}
 
-  struct proc *ptr;
-  int cnt;
+// Boost all processes into level 0 in O(1). The lists are
+// spliced here and each process catches up in qsync().
+static void
+qboost1(struct rq *rq)
+{
+  struct mlfq *mlfq = &rq->mlfq;
   int lev;
-  for(lev=1; lev<=2; lev++){
-    cnt = 0;
-    for(ptr=mlfq.queue[lev]; ptr!=0;){
+
+  for(lev=1; lev<sparam.nlev; lev++){
+    qsplice(&mlfq->run[0], &mlfq->run[lev]);
+    qsplice(&mlfq->blk[0], &mlfq->blk[lev]);
+  }
+  mlfq->bitmap = (mlfq->run[0].head != 0) ? 1 : 0;
+  mlfq->epoch++;
+  schedev(SE_BOOST, 0, mlfq->epoch);
+
 #ifdef SCHDEBUG
-        cprintf("boost[%d] %p %d\n", lev, ptr, ptr->qlev);
+  cprintf("boost %d\n", mlfq->epoch);
 #endif
-      qpop(ptr);
-      qmove(ptr, 0);
-      ptr=ptr->qnext;
-      cnt++;
+}
+
+// Called by each CPU on its own timer interrupt. The boost
+// period is counted per CPU, while p runs in MLFQ there.
+void
+qtick(int cpu, struct proc *p)
+{
+  struct rq *rq = &rqs[cpu];
+
+  if(p == 0 || p->qlev < 0 || p->state != RUNNING)
+    return;
+
+  acquire(&rq->lock);
+  if(++rq->mlfqticks % sparam.bstprd == 0)
+    qboost1(rq);
+  release(&rq->lock);
+}
+
+// Restrict p to the CPUs of mask, moving it to an allowed run
+// queue if needed. A stride process needs one which its share
+// fits in.
+int
+setaffinity(struct proc *p, uint mask)
+{
+  struct rq *rq, *dst, *ptr;
+
+  mask &= (1 << ncpu) - 1;
+  if(mask == 0)
+    return -1;
+
+  if(p->qin == QNONE){
+    p->affinity = mask;
+    return 0;
+  }
+
+  for(;;){
+    dst = 0;
+    for(ptr = rqs; ptr < &rqs[ncpu]; ptr++){
+      if(!(mask & (1 << (ptr - rqs))))
+        continue;
+      if(ptr == &rqs[p->qcpu]){
+        dst = ptr;
+        break;
+      }
+      if(p->qlev < 0){
+        if(ptr->stride.shares + p->sshr <= sparam.sharemax &&
+            (dst == 0 || ptr->stride.shares < dst->stride.shares))
+          dst = ptr;
+      }else if(dst == 0 || ptr->nrun < dst->nrun){
+        dst = ptr;
+      }
     }
-#ifdef SCHDEBUG
-      cprintf("boost[%d] (%d)\n", lev, cnt);
-#endif
+    if(dst == 0)
+      return -2;
+
+    rq = &rqs[p->qcpu];
+    rqlock2(rq, dst);
+    if(rq == &rqs[p->qcpu])
+      break;
+    rqunlock2(rq, dst);
+  }
+
+  if(rq != dst && p->qlev < 0 &&
+      dst->stride.shares + p->sshr > sparam.sharemax){
+    rqunlock2(rq, dst);
+    return -2;
+  }
+
+  p->affinity = mask;
+  if(rq != dst)
+    qmigrate(rq, dst, p);
+  rqunlock2(rq, dst);
+
+  return 0;
+}
+
+// Set the wakeup policy of MLFQ. Returns the previous one.
+int
+setwakeup(int policy)
+{
+  int old = wakepolicy;
+
+  if(policy != WP_NONE && policy != WP_PREEMPT)
+    return -1;
+  wakepolicy = policy;
+  return old;
+}
+
+// Measure the cycles between timer ticks. Called by CPU 0 on
+// every tick, and smoothed since a tick can be delayed.
+void
+tsccalib(void)
+{
+  static uint64 last;
+  static int nsample;
+  uint64 now = rdtsc();
+  uint64 cycles = now - last;
+
+  if(cycles > 0xffffffff)
+    cycles = 0xffffffff;
+
+  if(last != 0){
+    if(nsample++ == 0)
+      tsctick = cycles;
+    else
+      tsctick = tsctick - tsctick/8 + (uint)cycles/8;
   }
+  last = now;
 }
 
+// The share is guaranteed within a single CPU, so a process
+// is moved to the run queue which still has enough shares.
 int
 setsshr(struct proc *p, int share)
 {
+  struct rq *rq, *dst, *ptr;
+  int cur, dstcur;
+
   if(share <= 0)
     return -1;
 
+  // Find the least shared run queue, excluding the
+  // shares which p already holds.
+  dst = 0;
+  dstcur = 0;
+  for(ptr = rqs; ptr < &rqs[ncpu]; ptr++){
+    if(!(p->affinity & (1 << (ptr - rqs))))
+      continue;
+    cur = ptr->stride.shares;
+    if(p->qlev < 0 && ptr == &rqs[p->qcpu])
+      cur -= p->sshr;
+    if(cur + share <= sparam.sharemax && (dst == 0 || cur < dstcur)){
+      dst = ptr;
+      dstcur = cur;
+    }
+  }
+
   // Check the maximum of total shares.
-  if((stride.shares - p->sshr + share) > SHAREMAX)
+  if(dst == 0)
     return -2;
 
-  int minpass = stride.mlfqpass;
-  struct proc *ptr = stride.queue;
-  for(;ptr != 0;){
-    if(ptr->spass < minpass)
-      minpass = ptr->spass;
-    ptr = ptr->qnext;
+  for(;;){
+    rq = &rqs[p->qcpu];
+    rqlock2(rq, dst);
+    if(rq == &rqs[p->qcpu])
+      break;
+    rqunlock2(rq, dst);
   }
 
-  if(p->qlev >= 0){
-    qpop(p);
-    p->qlev = -1;
-    p->qelpsd = 0;
-    p->qnext = stride.queue;
-    stride.queue = p;
-    stride.shares += share;
-  }else{
-    stride.shares += (share - p->sshr);
+  cur = dst->stride.shares;
+  if(p->qlev < 0 && rq == dst)
+    cur -= p->sshr;
+  if(cur + share > sparam.sharemax){
+    rqunlock2(rq, dst);
+    return -2;
   }
 
+  if(p->qlev < 0 && rq == dst){
+    dst->stride.shares += (share - p->sshr);
+    p->sshr = share;
+    schedev(SE_SHARE, p, p->qcpu);
+    rqunlock2(rq, dst);
+    return 0;
+  }
+
+  qremove(rq, p);
+  p->qcpu = dst - rqs;
+  p->qlev = -1;
+  p->qelpsd = 0;
+  p->qslice = 0;
+  p->qin = QRUN;
   p->sshr = share;
-  p->spass = minpass;
+  p->spass = minpass(dst);
+  hpush(&dst->stride, p);
+  dst->stride.shares += share;
+  schedev(SE_SHARE, p, p->qcpu);
+  rqunlock2(rq, dst);
 
   return 0;
 }
+
+// Move the processes of the levels from lev on into the last
+// level of nlev levels, keeping their order.
+static void
+qshrink(struct rq *rq, int lev, int nlev)
+{
+  struct mlfq *mlfq = &rq->mlfq;
+  struct proc *p;
+
+  for(; lev < sparam.nlev; lev++){
+    for(p = mlfq->run[lev].head; p != 0; p = p->qnext)
+      p->qlev = nlev-1;
+    for(p = mlfq->blk[lev].head; p != 0; p = p->qnext)
+      p->qlev = nlev-1;
+    qsplice(&mlfq->run[nlev-1], &mlfq->run[lev]);
+    qsplice(&mlfq->blk[nlev-1], &mlfq->blk[lev]);
+  }
+
+  mlfq->bitmap &= (1 << nlev) - 1;
+  if(mlfq->run[nlev-1].head != 0)
+    mlfq->bitmap |= 1 << (nlev-1);
+}
+
+// Replace the parameters of every run queue at once.
+int
+setparam(struct schedparam *param)
+{
+  struct rq *rq;
+  int lev;
+
+  if(param->nlev < 1 || param->nlev > MLFQMAX)
+    return -1;
+  for(lev = 0; lev < param->nlev; lev++)
+    if(param->qticks[lev] <= 0 ||
+        (lev < param->nlev-1 && param->altmt[lev] <= 0))
+      return -1;
+  if(param->bstprd <= 0 || param->ssticks <= 0 ||
+      param->sharemax <= 0 || param->sharemax >= 100 ||
+      param->gtickets < 100)
+    return -1;
+
+  for(rq = rqs; rq < &rqs[ncpu]; rq++)
+    acquire(&rq->lock);
+
+  if(param->nlev < sparam.nlev)
+    for(rq = rqs; rq < &rqs[ncpu]; rq++)
+      qshrink(rq, param->nlev, param->nlev);
+  sparam = *param;
+
+  for(rq = &rqs[ncpu-1]; rq >= rqs; rq--)
+    release(&rq->lock);
+
+  return 0;
+}
+
+void
+getparam(struct schedparam *param)
+{
+  acquire(&rqs[0].lock);
+  *param = sparam;
+  release(&rqs[0].lock);
+}
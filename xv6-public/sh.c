@@ -3,6 +3,7 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "param.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+int spawncmd(char*);
 
 // Execute cmd.  Never returns.
 void
@@ -164,6 +166,8 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(spawncmd(buf) == 0)
+      continue;
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait();
@@ -491,3 +495,44 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+//PAGEBREAK!
+// Run buf with spawn() and wait for it, if it's just a program
+// and its arguments; the shell needn't fork for it. Return -1
+// if buf needs parsecmd().
+int
+spawncmd(char *buf)
+{
+  static int fdmap[NOFILE];
+  char *argv[MAXARGS], *s;
+  int argc, i;
+
+  // Anything but words is left to parsecmd().
+  argc = 0;
+  for(s = buf; *s; s++){
+    if(strchr(symbols, *s))
+      return -1;
+    if(!strchr(whitespace, *s) && (s == buf || strchr(whitespace, s[-1])))
+      argc++;
+  }
+  if(argc == 0 || argc >= MAXARGS)
+    return -1;
+
+  argc = 0;
+  for(s = buf; *s; s++){
+    if(strchr(whitespace, *s))
+      *s = 0;
+    else if(s == buf || s[-1] == 0)
+      argv[argc++] = s;
+  }
+  argv[argc] = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    fdmap[i] = i < 3 ? i : -1;
+  if(spawn(argv[0], argv, fdmap) < 0){
+    printf(2, "exec %s failed\n", argv[0]);
+    return 0;
+  }
+  wait();
+  return 0;
+}
@@ -17,17 +17,50 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  memset(&lk->stat, 0, sizeof(lk->stat));
 }
 
+// Whether the holder of lk is still owner, running on another
+// CPU. It is read without lk->lk, so it's only a hint.
+static int
+ownerruns(struct sleeplock *lk, struct proc *owner)
+{
+  return lk->locked && lk->owner == owner && owner->state == RUNNING;
+}
+
+// Spin while the holder runs on another CPU, since buffer and
+// inode locks are mostly held for less than a context switch
+// would take. Sleep once it sleeps or gets preempted.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *owner;
+  uint64 start;
+
   acquire(&lk->lk);
+  lk->stat.nacquire++;
+  if(lk->locked){
+    lk->stat.ncontend++;
+    start = rdtsc();
+    while((owner = lk->owner) != 0 && owner != myproc() &&
+          ownerruns(lk, owner)){
+      release(&lk->lk);
+      while(ownerruns(lk, owner))
+        asm volatile("pause" : : : "memory");
+      acquire(&lk->lk);
+    }
+    lk->stat.spincycles += rdtsc() - start;
+    if(!lk->locked)
+      lk->stat.nspin++;
+  }
   while (lk->locked) {
+    lk->stat.nsleep++;
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
   release(&lk->lk);
 }
 
@@ -37,7 +70,9 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  lk->owner = 0;
+  // The woken waiter takes the lock; the others keep sleeping.
+  wakeone(lk);
   release(&lk->lk);
 }
 
@@ -52,5 +87,15 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
-
-
+// Add the statistics of lk to st.
+void
+sleeplockstat(struct sleeplock *lk, lockstat_t *st)
+{
+  acquire(&lk->lk);
+  st->nacquire += lk->stat.nacquire;
+  st->ncontend += lk->stat.ncontend;
+  st->nspin += lk->stat.nspin;
+  st->nsleep += lk->stat.nsleep;
+  st->spincycles += lk->stat.spincycles;
+  release(&lk->lk);
+}
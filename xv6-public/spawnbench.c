@@ -0,0 +1,64 @@
+// Measure process-launch throughput of fork()+exec() and of
+// spawn(). Each child runs "spawnbench -", which exits at once.
+// usage: spawnbench [n]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+char *args[] = { "spawnbench", "-", 0 };
+
+int
+forkexec(int n)
+{
+  int i, pid, start;
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(2, "spawnbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      printf(2, "spawnbench: exec failed\n");
+      exit();
+    }
+    wait();
+  }
+  return uptime() - start;
+}
+
+int
+spawnn(int n)
+{
+  int i, start;
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    if(spawn(args[0], args, 0) < 0){
+      printf(2, "spawnbench: spawn failed\n");
+      break;
+    }
+    wait();
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100, tfork, tspawn;
+
+  if(argc > 1 && argv[1][0] == '-')
+    exit();
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  tfork = forkexec(n);
+  tspawn = spawnn(n);
+  printf(1, "%d launches (ticks): fork+exec %d, spawn %d\n",
+         n, tfork, tspawn);
+  exit();
+}
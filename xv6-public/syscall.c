@@ -21,6 +21,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(prefault(addr, 4) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +41,8 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && prefault((uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -65,6 +69,11 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  // The kernel may use it while holding locks. This maps every
+  // page of it now, even those the call won't touch, e.g. all
+  // of a large read() buffer in the lazy heap.
+  if(prefault(i, size) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -109,16 +118,22 @@ extern int sys_set_cpu_share(void);
 extern int sys_thread_create(void);
 extern int sys_thread_exit(void);
 extern int sys_thread_join(void);
-extern int sys_xem_init(void);
-extern int sys_xem_wait(void);
-extern int sys_xem_unlock(void);
-extern int sys_rwlock_init(void);
-extern int sys_rwlock_acquire_readlock(void);
-extern int sys_rwlock_acquire_writelock(void);
-extern int sys_rwlock_release_readlock(void);
-extern int sys_rwlock_release_writelock(void);
 extern int sys_pread(void);
 extern int sys_pwrite(void);
+extern int sys_sched_trace(void);
+extern int sys_sched_drain(void);
+extern int sys_sched_wakeup(void);
+extern int sys_getschedlat(void);
+extern int sys_sched_setparam(void);
+extern int sys_sched_getparam(void);
+extern int sys_set_affinity(void);
+extern int sys_thread_park(void);
+extern int sys_thread_unpark(void);
+extern int sys_getlwpstat(void);
+extern int sys_thread_create_attr(void);
+extern int sys_spawn(void);
+extern int sys_futex(void);
+extern int sys_getlockstat(void);
 
 
 static int (*syscalls[])(void) = {
@@ -149,16 +164,22 @@ static int (*syscalls[])(void) = {
 [SYS_thread_create] sys_thread_create,
 [SYS_thread_exit]   sys_thread_exit,
 [SYS_thread_join]   sys_thread_join,
-[SYS_xem_init]    sys_xem_init,
-[SYS_xem_wait]    sys_xem_wait,
-[SYS_xem_unlock]  sys_xem_unlock,
-[SYS_rwlock_init] sys_rwlock_init,
-[SYS_rwlock_acquire_readlock]   sys_rwlock_acquire_readlock,
-[SYS_rwlock_acquire_writelock]  sys_rwlock_acquire_writelock,
-[SYS_rwlock_release_readlock]   sys_rwlock_release_readlock,
-[SYS_rwlock_release_writelock]  sys_rwlock_release_writelock,
 [SYS_pread]  sys_pread,
 [SYS_pwrite] sys_pwrite,
+[SYS_sched_trace] sys_sched_trace,
+[SYS_sched_drain] sys_sched_drain,
+[SYS_sched_wakeup] sys_sched_wakeup,
+[SYS_getschedlat] sys_getschedlat,
+[SYS_sched_setparam] sys_sched_setparam,
+[SYS_sched_getparam] sys_sched_getparam,
+[SYS_set_affinity] sys_set_affinity,
+[SYS_thread_park] sys_thread_park,
+[SYS_thread_unpark] sys_thread_unpark,
+[SYS_getlwpstat] sys_getlwpstat,
+[SYS_thread_create_attr] sys_thread_create_attr,
+[SYS_spawn]   sys_spawn,
+[SYS_futex]   sys_futex,
+[SYS_getlockstat] sys_getlockstat,
 };
 
 void
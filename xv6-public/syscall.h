@@ -29,15 +29,20 @@
 #define SYS_thread_exit   26
 #define SYS_thread_join   27
 
-#define SYS_xem_init      28
-#define SYS_xem_wait      29
-#define SYS_xem_unlock    30
-
-#define SYS_rwlock_init               31
-#define SYS_rwlock_acquire_readlock   32
-#define SYS_rwlock_acquire_writelock  33
-#define SYS_rwlock_release_readlock   34
-#define SYS_rwlock_release_writelock  35
-
 #define SYS_pread   36
 #define SYS_pwrite  37
+
+#define SYS_sched_trace 38
+#define SYS_sched_drain 39
+#define SYS_sched_wakeup 40
+#define SYS_getschedlat 41
+#define SYS_sched_setparam 42
+#define SYS_sched_getparam 43
+#define SYS_set_affinity 44
+#define SYS_thread_park 45
+#define SYS_thread_unpark 46
+#define SYS_getlwpstat 47
+#define SYS_thread_create_attr 48
+#define SYS_spawn  49
+#define SYS_futex  50
+#define SYS_getlockstat 51
@@ -116,6 +116,26 @@ sys_pwrite(void)
   return filepwrite(f, p, n, off);
 }
 
+// Contention statistics of the buffer or inode locks.
+int
+sys_getlockstat(void)
+{
+  lockstat_t *st, s;
+  int which;
+
+  if(argint(0, &which) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  memset(&s, 0, sizeof(s));
+  if(which == LS_BUF)
+    bstat(&s);
+  else if(which == LS_INODE)
+    istat(&s);
+  else
+    return -1;
+  *st = s;
+  return 0;
+}
+
 int
 sys_close(void)
 {
@@ -339,6 +359,12 @@ sys_open(void)
       return -1;
     }
   }
+  // A running program can't be opened for writing.
+  if(ip->nexec > 0 && (omode & (O_WRONLY|O_RDWR))){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
 
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
@@ -419,19 +445,16 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the null-terminated argument vector at uargv.
+static int
+fetchargv(uint uargv, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
-  uint uargv, uarg;
+  uint uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -442,9 +465,45 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+  uint uargv;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
   return exec(path, argv);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  int *fdmap, ufdmap, copy[NOFILE];
+  uint uargv;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0 ||
+     argint(2, &ufdmap) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+  fdmap = 0;
+  if(ufdmap != 0){
+    if(argptr(2, (void*)&fdmap, sizeof(copy)) < 0)
+      return -1;
+    memmove(copy, fdmap, sizeof(copy));
+    fdmap = copy;
+  }
+  return spawn(path, argv, fdmap);
+}
+
 int
 sys_pipe(void)
 {
@@ -45,7 +45,7 @@ sys_getpid(void)
 int
 getlev(void)
 {
-  return myproc()->qlev;
+  return qlevel(myproc());
 }
 
 int
@@ -63,8 +63,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if((addr = growproc(n)) < 0)
     return -1;
   return addr;
 }
@@ -121,6 +120,35 @@ sys_thread_create(void)
   return thread_create((thread_t*) thread, (void*) start_routine, (void*) arg);
 }
 
+int
+sys_thread_create_attr(void)
+{
+  int thread, start_routine, arg, attr;
+  thread_attr_t copy;
+
+  if(argint(0, &thread) < 0)
+    return -1;
+
+  if(argint(1, &start_routine) < 0)
+    return -1;
+
+  if(argint(2, &arg) < 0)
+    return -1;
+
+  if(argint(3, &attr) < 0)
+    return -1;
+
+  // A null attr means the defaults of thread_create().
+  if(attr != 0){
+    if(argptr(3, (void*)&attr, sizeof(copy)) < 0)
+      return -1;
+    copy = *(thread_attr_t*)attr;
+  }
+
+  return thread_create_attr((thread_t*) thread, (void*) start_routine,
+                            (void*) arg, attr ? &copy : 0);
+}
+
 void
 sys_thread_exit(void)
 {
@@ -145,3 +173,31 @@ sys_thread_join(void)
 
   return thread_join((thread_t) thread, (void**) retval);
 }
+
+int
+sys_thread_park(void)
+{
+  return thread_park();
+}
+
+int
+sys_thread_unpark(void)
+{
+  int thread;
+
+  if(argint(0, &thread) < 0)
+    return -1;
+
+  return thread_unpark((thread_t) thread);
+}
+
+int
+sys_getlwpstat(void)
+{
+  lwpstat_t *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+
+  return getlwpstat(st);
+}
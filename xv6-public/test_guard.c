@@ -0,0 +1,74 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define FRAME 512
+#define DEPTH 64          // 32KB of frames, far beyond the stack
+
+volatile int reached;
+
+// Use FRAME bytes of stack in each of depth frames.
+int
+recurse(int depth)
+{
+  volatile char buf[FRAME];
+  int i;
+
+  for(i = 0; i < FRAME; i++)
+    buf[i] = depth;
+  if(depth == 0)
+    return buf[0];
+  return recurse(depth - 1) + buf[FRAME-1];
+}
+
+void*
+overrun(void *arg)
+{
+  recurse(DEPTH);
+  reached = 1;
+  thread_exit(0);
+  return 0;
+}
+
+void*
+fits(void *arg)
+{
+  recurse(4);
+  reached = 1;
+  thread_exit(0);
+  return 0;
+}
+
+// Run fn on a stack of 4KB with a guard of 8KB.
+int
+run(void* (*fn)(void*))
+{
+  thread_attr_t attr;
+  thread_t t;
+  void *ret;
+
+  attr.stacksize = 4096;
+  attr.guardsize = 8192;
+  reached = 0;
+  if(thread_create_attr(&t, fn, 0, &attr) < 0){
+    printf(1, "panic at thread create\n");
+    exit();
+  }
+  if(thread_join(t, &ret) < 0){
+    printf(1, "panic at thread join\n");
+    exit();
+  }
+  return reached;
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "1. A thread within its stack finishes\n");
+  printf(1, run(fits) ? "ok\n" : "failed\n");
+
+  printf(1, "2. A thread overrunning its stack is killed in the guard\n");
+  printf(1, run(overrun) ? "failed\n" : "ok\n");
+
+  exit();
+}
@@ -1,6 +1,7 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "x86.h"
 
 xem_t sem;
 rwlock_t rwlock;
@@ -10,6 +11,14 @@ int writerElapsedTicks;
 #define REP 50
 #define NTHREADS 10
 #define READERS_RATIO 0.9
+#define REP3 200
+#define WRITERS3 4   // Writers of test3, so the policies differ
+#define NBUCKET 40
+
+// Acquire latency of readers and writers, by log2 of cycles
+uint lathist[2][NBUCKET];
+
+char *policynames[] = { "reader-preferring", "writer-preferring", "phase-fair" };
 
 void * reader_with_rwlock(void *arg);
 void * writer_with_rwlock(void *arg);
@@ -17,9 +26,13 @@ void * reader2_with_sem(void *arg);
 void * writer2_with_sem(void *arg);
 void * reader2_with_rwlock(void *arg);
 void * writer2_with_rwlock(void *arg);
+void * reader3(void *arg);
+void * writer3(void *arg);
 
 void test1(void);
 void test2(void);
+void test3(void);
+void test4(void);
 
 int
 main(int argc, char *argv[])
@@ -33,6 +46,12 @@ main(int argc, char *argv[])
   /* TEST for efficiency of performance of RW lock */
   test2();
 
+  /* TEST for throughput and tail latency of each policy */
+  test3();
+
+  /* TEST for the main thread waiting on LWPs holding the lock */
+  test4();
+
   exit();
 }
 
@@ -250,3 +269,166 @@ writer2_with_rwlock(void *arg)
   thread_exit(0);
   return 0;
 }
+
+int
+log2(uint64 v)
+{
+  int k = 0;
+
+  while(v >>= 1)
+    k++;
+  return k;
+}
+
+void
+record(int iswriter, uint64 start)
+{
+  int k = log2(rdtsc() - start);
+
+  __sync_fetch_and_add(&lathist[iswriter][k < NBUCKET ? k : NBUCKET-1], 1);
+}
+
+// Smallest bucket holding pct% of the acquisitions.
+int
+percentile(uint *hist, int pct)
+{
+  uint total = 0, sum = 0;
+  int k;
+
+  for(k = 0; k < NBUCKET; k++)
+    total += hist[k];
+  for(k = 0; k < NBUCKET; k++){
+    sum += hist[k];
+    if(sum * 100 >= total * pct)
+      break;
+  }
+  return k;
+}
+
+void
+report(char *who, uint *hist)
+{
+  printf(1, "\t\t%s latency: p50 2^%d p99 2^%d max 2^%d cycles\n", who,
+         percentile(hist, 50), percentile(hist, 99), percentile(hist, 100));
+}
+
+void
+test3(void)
+{
+  thread_t t[NTHREADS];
+  void *ret;
+  int startTick, ticks;
+
+  printf(1, "3. Throughput and tail latency of each policy\n");
+  for(int policy = RWP_READER; policy <= RWP_FAIR; ++policy) {
+    rwlock_init_policy(&rwlock, policy);
+    memset(lathist, 0, sizeof(lathist));
+
+    startTick = uptime();
+    for(int i = 0; i < NTHREADS; ++i) {
+      void* (*start_routine)(void *) = i >= NTHREADS - WRITERS3 ? writer3 : reader3;
+      if(thread_create(&t[i], start_routine, (void *)(i)) < 0) {
+        printf(1, "panic at thread create\n");
+        exit();
+      }
+    }
+    for(int i = 0; i < NTHREADS; ++i) {
+      if(thread_join(t[i], &ret) < 0) {
+        printf(1, "panic at thread join\n");
+        exit();
+      }
+    }
+    ticks = uptime() - startTick;
+
+    printf(1, "\t%s: %d acquisitions in %d ticks\n", policynames[policy],
+           NTHREADS * REP3, ticks);
+    report("reader", lathist[0]);
+    report("writer", lathist[1]);
+  }
+}
+
+void
+test4(void)
+{
+  thread_t t[NTHREADS];
+  void *ret;
+  int sum;
+
+  printf(1, "4. The main thread contends with LWPs\n");
+  for(int policy = RWP_READER; policy <= RWP_FAIR; ++policy) {
+    rwlock_init_policy(&rwlock, policy);
+
+    for(int i = 0; i < NTHREADS; ++i) {
+      void* (*start_routine)(void *) = i >= NTHREADS - WRITERS3 ? writer3 : reader3;
+      if(thread_create(&t[i], start_routine, (void *)(i)) < 0) {
+        printf(1, "panic at thread create\n");
+        exit();
+      }
+    }
+    // The main thread sleeps in the kernel whenever an LWP
+    // holds the lock, and must be woken up by it.
+    for(int rep = 0; rep < REP3; ++rep) {
+      rwlock_acquire_writelock(&rwlock);
+      for(int i = 0; i < 10000; ++i)
+        data[i] = 0;
+      rwlock_release_writelock(&rwlock);
+
+      sum = 0;
+      rwlock_acquire_readlock(&rwlock);
+      for(int i = 0; i < 10000; ++i)
+        sum += data[i];
+      if(!(sum == 0 || sum == 5000 * 10001))
+        printf(1, "Race detected\n");
+      rwlock_release_readlock(&rwlock);
+    }
+    for(int i = 0; i < NTHREADS; ++i) {
+      if(thread_join(t[i], &ret) < 0) {
+        printf(1, "panic at thread join\n");
+        exit();
+      }
+    }
+
+    printf(1, "\t%s: ok\n", policynames[policy]);
+  }
+}
+
+void *
+reader3(void *arg)
+{
+  uint64 start;
+  int sum;
+
+  for(int rep = 0; rep < REP3; ++rep) {
+    sum = 0;
+    start = rdtsc();
+    rwlock_acquire_readlock(&rwlock);
+    record(0, start);
+    for(int i = 0; i < 10000; ++i)
+      sum += data[i];
+    if(!(sum == 0 || sum == 5000 * 10001))
+      printf(1, "Race detected\n");
+    rwlock_release_readlock(&rwlock);
+  }
+
+  thread_exit(0);
+  return 0;
+}
+
+void *
+writer3(void *arg)
+{
+  int id = (int)arg;
+  uint64 start;
+
+  for(int rep = 0; rep < REP3; ++rep) {
+    start = rdtsc();
+    rwlock_acquire_writelock(&rwlock);
+    record(1, start);
+    for(int i = 0; i < 10000; ++i)
+      data[i] = id % 2 == 0 ? i + 1 : 10000 - i;
+    rwlock_release_writelock(&rwlock);
+  }
+
+  thread_exit(0);
+  return 0;
+}
@@ -5,6 +5,10 @@
 #define LARGENUM 10000
 #define THREADS  10
 #define REP     3
+#define NWAITER 4
+
+int nposted;
+volatile int held, released;
 
 xem_t xem;
 
@@ -43,6 +47,28 @@ test_with_sem1(void *arg)
   return 0;
 }
 
+void *
+test_with_sem2(void *arg)
+{
+  xem_wait(&xem);
+  __sync_fetch_and_add(&nposted, 1);
+  thread_exit(0);
+  return 0;
+}
+
+// Hold the semaphore while the main thread waits on it.
+void *
+test_with_sem3(void *arg)
+{
+  xem_wait(&xem);
+  held = 1;
+  sleep(10);
+  released = 1;
+  xem_unlock(&xem);
+  thread_exit(0);
+  return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -89,6 +115,42 @@ main(int argc, char *argv[])
     }
   }
   printf(1, "\nIts sequence must be sorted\n");
+
+  printf(1, "3. Test with units posted several times to sleeping waiters\n");
+  xem_init(&xem);
+  xem_wait(&xem);
+  for(int i = 0; i < NWAITER; ++i) {
+    if(thread_create(&t[i], test_with_sem2, 0) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  sleep(10);   // Let them all sleep on the semaphore
+  for(int i = 0; i < NWAITER; ++i)
+    xem_unlock(&xem);
+  for(int i = 0; i < NWAITER; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  printf(1, "%d of %d waiters passed\n", nposted, NWAITER);
+
+  printf(1, "4. Test with the main thread waiting for an LWP\n");
+  xem_init(&xem);
+  if(thread_create(&t[0], test_with_sem3, 0) < 0) {
+    printf(1, "panic at thread create\n");
+    exit();
+  }
+  while(!held)
+    yield();
+  xem_wait(&xem);
+  printf(1, released ? "ok\n" : "failed\n");
+  xem_unlock(&xem);
+  if(thread_join(t[0], &ret) < 0) {
+    printf(1, "panic at thread join\n");
+    exit();
+  }
   
   exit();
 
@@ -0,0 +1,104 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NUM_THREAD 8
+#define NSWITCH 100
+#define MAINVAL 0xabc
+
+volatile int nfail;
+
+// Whether the TLS word 0 still points to itself.
+int
+tlsself(void)
+{
+  return tlsget(0) == (uint)tls();
+}
+
+void*
+thread_main(void *arg)
+{
+  int id = (int)arg;
+  int i;
+
+  if(!tlsself() || tlsget(1) != 0){
+    printf(1, "thread %d: TLS not fresh\n", id);
+    __sync_fetch_and_add(&nfail, 1);
+  }
+  tlsset(1, 100 + id);
+
+  // Let the other LWPs run and write their own slots.
+  for(i = 0; i < NSWITCH; i++){
+    yield();
+    if(tlsget(1) != 100 + id || !tlsself()){
+      printf(1, "thread %d: TLS overwritten (%d)\n", id, tlsget(1));
+      __sync_fetch_and_add(&nfail, 1);
+      break;
+    }
+  }
+  thread_exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t[NUM_THREAD];
+  void *ret;
+  void *mine;
+  char *args[3];
+  int i, pid;
+
+  // Run again by exec below.
+  if(argc > 1){
+    if(!tlsself() || tlsget(1) != 0){
+      printf(1, "exec: TLS not fresh\n");
+      exit();
+    }
+    printf(1, "exec: ok\n");
+    exit();
+  }
+
+  printf(1, "1. Each LWP has its own TLS\n");
+  mine = tls();
+  tlsset(1, MAINVAL);
+  for(i = 0; i < NUM_THREAD; i++){
+    if(thread_create(&t[i], thread_main, (void*)i) < 0){
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(i = 0; i < NUM_THREAD; i++){
+    if(thread_join(t[i], &ret) < 0){
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  if(tls() != mine || tlsget(1) != MAINVAL){
+    printf(1, "main: TLS changed by thread_create\n");
+    nfail++;
+  }
+  printf(1, nfail == 0 ? "ok\n" : "failed\n");
+
+  printf(1, "2. fork keeps TLS, exec resets it\n");
+  pid = fork();
+  if(pid < 0){
+    printf(1, "panic at fork\n");
+    exit();
+  }
+  if(pid == 0){
+    if(tls() != mine || tlsget(1) != MAINVAL){
+      printf(1, "fork: TLS not kept\n");
+      exit();
+    }
+    printf(1, "fork: ok\n");
+    args[0] = argv[0];
+    args[1] = "exec";
+    args[2] = 0;
+    exec(args[0], args);
+    printf(1, "panic at exec\n");
+    exit();
+  }
+  wait();
+  exit();
+}
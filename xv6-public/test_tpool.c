@@ -0,0 +1,97 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define NWORKER 4
+#define NTASK 256
+#define NWAKE 20
+
+int result[NTASK];
+volatile uint64 ran;      // TSC when the latency task ran
+
+void
+square(void *arg)
+{
+  int i = (int)arg;
+
+  result[i] = i * i;
+}
+
+void
+stamp(void *arg)
+{
+  ran = rdtsc();
+}
+
+// Submit NTASK squares to tp and check them after tpool_wait().
+int
+squares(struct tpool *tp)
+{
+  int i;
+
+  memset(result, 0, sizeof(result));
+  for(i = 0; i < NTASK; i++){
+    if(tpool_submit(tp, square, (void*)i) < 0){
+      printf(1, "panic at tpool submit\n");
+      exit();
+    }
+  }
+  tpool_wait(tp);
+  for(i = 0; i < NTASK; i++){
+    if(result[i] != i * i){
+      printf(1, "task %d: %d\n", i, result[i]);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct tpool *tp;
+  uint64 t0;
+  uint d, sum = 0, min = ~0, max = 0;
+  int i;
+
+  if((tp = tpool_create(NWORKER)) == 0){
+    printf(1, "panic at tpool create\n");
+    exit();
+  }
+
+  printf(1, "1. Every task runs once\n");
+  printf(1, squares(tp) ? "ok\n" : "failed\n");
+
+  printf(1, "2. The pool is reused after tpool_wait\n");
+  printf(1, squares(tp) ? "ok\n" : "failed\n");
+
+  // Each round waits a tick so that every worker has parked,
+  // then times a task from tpool_submit() until it runs.
+  printf(1, "3. Wake-up latency of a parked worker\n");
+  for(i = 0; i < NWAKE; i++){
+    sleep(1);
+    ran = 0;
+    t0 = rdtsc();
+    tpool_submit(tp, stamp, 0);
+    tpool_wait(tp);
+    d = ran - t0;
+    sum += d;
+    if(d < min)
+      min = d;
+    if(d > max)
+      max = d;
+  }
+  printf(1, "\t\tmin %d avg %d max %d cycles\n", min, sum / NWAKE, max);
+
+  printf(1, "4. tpool_destroy finishes the queued tasks\n");
+  memset(result, 0, sizeof(result));
+  for(i = 0; i < NTASK; i++)
+    tpool_submit(tp, square, (void*)i);
+  tpool_destroy(tp);
+  for(i = 0; i < NTASK && result[i] == i * i; i++)
+    ;
+  printf(1, i == NTASK ? "ok\n" : "failed\n");
+
+  exit();
+}
@@ -0,0 +1,83 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define COPY "txtbsy"
+
+char buf[512];
+
+// Copy the file src to a new file dst, and return an fd of
+// dst still open for writing.
+int
+copy(char *src, char *dst)
+{
+  int in, out, n;
+
+  if((in = open(src, O_RDONLY)) < 0)
+    return -1;
+  if((out = open(dst, O_CREATE|O_RDWR)) < 0){
+    close(in);
+    return -1;
+  }
+  while((n = read(in, buf, sizeof(buf))) > 0)
+    if(write(out, buf, n) != n){
+      n = -1;
+      break;
+    }
+  close(in);
+  if(n < 0){
+    close(out);
+    return -1;
+  }
+  return out;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *args[3];
+  int fd, pid;
+
+  // Run again by exec below; stay long enough to be written to.
+  if(argc > 1){
+    sleep(100);
+    exit();
+  }
+
+  printf(1, "1. A running program can't be opened for writing\n");
+  if((fd = open(argv[0], O_WRONLY)) >= 0){
+    close(fd);
+    printf(1, "failed\n");
+  } else
+    printf(1, "ok\n");
+
+  printf(1, "2. A running program can't be written through an older fd\n");
+  if((fd = copy(argv[0], COPY)) < 0){
+    printf(1, "panic at copy\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "panic at fork\n");
+    exit();
+  }
+  if(pid == 0){
+    args[0] = COPY;
+    args[1] = "run";
+    args[2] = 0;
+    exec(args[0], args);
+    printf(1, "panic at exec\n");
+    exit();
+  }
+  sleep(20);
+  printf(1, write(fd, "x", 1) < 0 ? "ok\n" : "failed\n");
+
+  printf(1, "3. The program can be written after it exits\n");
+  wait();
+  printf(1, write(fd, "x", 1) == 1 ? "ok\n" : "failed\n");
+  close(fd);
+  unlink(COPY);
+
+  exit();
+}
@@ -0,0 +1,103 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "sched.h"
+
+#define NSPIN 3           // CPU-bound processes ahead of the sleeper
+#define NSLEEP 20         // Wakeups measured under each policy
+#define QTICKS 5          // Time quantum of the single MLFQ level
+
+char *names[] = { "WP_NONE", "WP_PREEMPT" };
+
+// sum/n without 64-bit division.
+uint
+mean(uint64 sum, uint n)
+{
+  while(sum > 0xffffffff){
+    sum >>= 1;
+    n >>= 1;
+  }
+  if(n == 0)
+    return 0;
+  return (uint)sum / n;
+}
+
+// Run NSPIN spinners and a sleeper on CPU 0 under the wakeup
+// policy, and return the mean wakeup latency of the sleeper.
+uint
+measure(int policy)
+{
+  struct schedlat lat;
+  int pids[NSPIN], fd[2], i, pid;
+
+  sched_wakeup(policy);
+  if(pipe(fd) < 0){
+    printf(1, "panic at pipe\n");
+    exit();
+  }
+  for(i = 0; i < NSPIN; i++){
+    if((pids[i] = fork()) < 0){
+      printf(1, "panic at fork\n");
+      exit();
+    }
+    if(pids[i] == 0){
+      set_affinity(0, 1);
+      for(;;)
+        ;
+    }
+  }
+  if((pid = fork()) < 0){
+    printf(1, "panic at fork\n");
+    exit();
+  }
+  if(pid == 0){
+    set_affinity(0, 1);
+    for(i = 0; i < NSLEEP; i++)
+      sleep(1);
+    getschedlat(0, &lat);
+    write(fd[1], &lat, sizeof(lat));
+    exit();
+  }
+
+  close(fd[1]);
+  if(read(fd[0], &lat, sizeof(lat)) != sizeof(lat))
+    lat.nwake = 0;
+  close(fd[0]);
+  for(i = 0; i < NSPIN; i++)
+    kill(pids[i]);
+  for(i = 0; i < NSPIN + 1; i++)
+    wait();
+
+  printf(1, "\t%s: %d wakeups, mean %d max %d cycles\n", names[policy],
+         lat.nwake, mean(lat.sumlat, lat.nwake), lat.maxlat);
+  return mean(lat.sumlat, lat.nwake);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct schedparam old, param;
+  int oldpolicy;
+  uint none, preempt;
+
+  // A single level of round robin puts the sleeper behind the
+  // spinners under WP_NONE, for up to NSPIN time quanta.
+  sched_getparam(&old);
+  param = old;
+  param.nlev = 1;
+  param.qticks[0] = QTICKS;
+  if(sched_setparam(&param) < 0){
+    printf(1, "panic at sched_setparam\n");
+    exit();
+  }
+  oldpolicy = sched_wakeup(WP_NONE);
+
+  printf(1, "1. A woken process preempts under WP_PREEMPT only\n");
+  none = measure(WP_NONE);
+  preempt = measure(WP_PREEMPT);
+  printf(1, preempt < none ? "ok\n" : "failed\n");
+
+  sched_wakeup(oldpolicy);
+  sched_setparam(&old);
+  exit();
+}
@@ -0,0 +1,195 @@
+// Thread pool on top of LWPs. Idle workers park in the kernel
+// instead of spinning, and a submitted task unparks one of them.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define TPOOLMAX 16       // Maximum workers of a pool
+#define TPOOLQ   64       // Maximum queued tasks of a pool
+
+struct task {
+  void (*fn)(void*);
+  void *arg;
+};
+
+struct tworker {
+  struct tpool *tp;
+  thread_t tid;
+  int idle;               // If non-zero, in the idle stack
+};
+
+struct tpool {
+  uint lock;
+  int nworker;
+  struct tworker w[TPOOLMAX];
+  int idle[TPOOLMAX];     // Parked workers, by index of w
+  int nidle;
+  struct task q[TPOOLQ];  // Ring of queued tasks
+  uint head;
+  uint tail;
+  int active;             // Running tasks
+  thread_t waiter;        // If non-zero, parked in tpool_wait()
+  int stop;
+};
+
+static void
+tplock(struct tpool *tp)
+{
+  while(xchg(&tp->lock, 1) != 0)
+    yield();
+}
+
+static void
+tpunlock(struct tpool *tp)
+{
+  xchg(&tp->lock, 0);
+}
+
+static void*
+tworker(void *arg)
+{
+  struct tworker *w = arg;
+  struct tpool *tp = w->tp;
+  struct task t;
+  thread_t waiter;
+
+  tplock(tp);
+  for(;;){
+    if(tp->head != tp->tail){
+      t = tp->q[tp->head++ % TPOOLQ];
+      tp->active++;
+      tpunlock(tp);
+
+      t.fn(t.arg);
+
+      tplock(tp);
+      tp->active--;
+      if(tp->head == tp->tail && tp->active == 0 && tp->waiter != 0){
+        waiter = tp->waiter;
+        tp->waiter = 0;
+        tpunlock(tp);
+        thread_unpark(waiter);
+        tplock(tp);
+      }
+      continue;
+    }
+
+    if(tp->stop)
+      break;
+
+    // thread_park() may return early, so push only once.
+    if(!w->idle){
+      w->idle = 1;
+      tp->idle[tp->nidle++] = w - tp->w;
+    }
+    tpunlock(tp);
+    thread_park();
+    tplock(tp);
+  }
+  tpunlock(tp);
+
+  thread_exit(0);
+  return 0;
+}
+
+struct tpool*
+tpool_create(int nworker)
+{
+  struct tpool *tp;
+  int i;
+
+  if(nworker <= 0 || nworker > TPOOLMAX)
+    return 0;
+  if((tp = malloc(sizeof(*tp))) == 0)
+    return 0;
+  memset(tp, 0, sizeof(*tp));
+
+  // Workers wait for the lock until their IDs are known.
+  tplock(tp);
+  for(i = 0; i < nworker; i++){
+    tp->w[i].tp = tp;
+    if(thread_create(&tp->w[i].tid, tworker, &tp->w[i]) < 0)
+      break;
+  }
+  tp->nworker = i;
+  tpunlock(tp);
+
+  if(i < nworker){
+    tpool_destroy(tp);
+    return 0;
+  }
+  return tp;
+}
+
+// Queue fn(arg) and wake up an idle worker. Waits while the
+// queue is full.
+int
+tpool_submit(struct tpool *tp, void (*fn)(void*), void *arg)
+{
+  thread_t tid = 0;
+  int i;
+
+  tplock(tp);
+  while(tp->tail - tp->head == TPOOLQ){
+    tpunlock(tp);
+    yield();
+    tplock(tp);
+  }
+  if(tp->stop){
+    tpunlock(tp);
+    return -1;
+  }
+
+  tp->q[tp->tail % TPOOLQ].fn = fn;
+  tp->q[tp->tail % TPOOLQ].arg = arg;
+  tp->tail++;
+
+  if(tp->nidle > 0){
+    i = tp->idle[--tp->nidle];
+    tp->w[i].idle = 0;
+    tid = tp->w[i].tid;
+  }
+  tpunlock(tp);
+
+  if(tid != 0)
+    thread_unpark(tid);
+  return 0;
+}
+
+// Wait until all the submitted tasks are done. Only one
+// thread may wait at a time.
+void
+tpool_wait(struct tpool *tp)
+{
+  tplock(tp);
+  while(tp->head != tp->tail || tp->active > 0){
+    tp->waiter = getpid();
+    tpunlock(tp);
+    thread_park();
+    tplock(tp);
+  }
+  tp->waiter = 0;
+  tpunlock(tp);
+}
+
+// Finish the submitted tasks, then join the workers.
+void
+tpool_destroy(struct tpool *tp)
+{
+  void *ret;
+  int i;
+
+  tpool_wait(tp);
+
+  tplock(tp);
+  tp->stop = 1;
+  tpunlock(tp);
+
+  for(i = 0; i < tp->nworker; i++){
+    thread_unpark(tp->w[i].tid);
+    thread_join(tp->w[i].tid, &ret);
+  }
+  free(tp);
+}
@@ -13,7 +13,6 @@ struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
-uint mlfqticks;
 
 void
 tvinit(void)
@@ -53,15 +52,14 @@ trap(struct trapframe *tf)
       acquire(&tickslock);
       ticks++;
       wakeup(&ticks);
-
-      if(myproc() != 0 && myproc()->qlev >= 0 && myproc()->state == RUNNING){
-        mlfqticks++;
-      }
+      tsccalib();
       release(&tickslock);
-
-      if(myproc() != 0 && myproc()->qlev >= 0 && myproc()->state == RUNNING)
-        mlfqelpsd(mlfqticks);
     }
+    qtick(cpuid(), myproc());
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_TLB:
+    tlbpoll();
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -86,6 +84,11 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    if(pgfault(rcr2(), tf->err) == 0)
+      break;
+    // Not ours to fix, so fall through.
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -1,28 +1,53 @@
-#define XEMQSIZE       (64*2) // size of semaphore's queue capacity
-
 typedef unsigned int   uint;
 typedef unsigned short ushort;
 typedef unsigned char  uchar;
+typedef unsigned long long uint64;
 typedef uint           pde_t;
 typedef unsigned int   thread_t;
 
+// Operations of futex()
+#define FUTEX_WAIT 0      // Sleep if the word still holds val
+#define FUTEX_WAKE 1      // Wake up waiters of the word
+
 typedef struct {
-  int value;
-  int lockidx;
-  int queue[XEMQSIZE];
-  int front;
-  int rear;
+  volatile int value;     // Free units, or -1 if none and contended
 } xem_t;
 
 typedef struct {
-  xem_t lock;
-  xem_t writelock;
-  int queue[XEMQSIZE];
-  int readers;
-  int wlowner;
+  volatile uint state;    // Readers, writer and sleepers (see xem.c)
+  int policy;             // One of RWP_*
 } rwlock_t;
 
+// Policies of rwlock_t
+#define RWP_READER 0      // Readers go first
+#define RWP_WRITER 1      // Writers go first
+#define RWP_FAIR   2      // Reader and writer phases alternate
+
 typedef struct {
   int fd;
   rwlock_t rwlock;
 } thread_safe_guard;
+
+typedef struct {
+  uint stacksize;         // Bytes of the stack, mapped on first touch
+  uint guardsize;         // Bytes left unmapped beneath the stack
+} thread_attr_t;
+
+typedef struct {
+  uint stkhit;            // LWP stacks reused from the cache
+  uint stkmiss;           // LWP stacks newly allocated
+  uint kshit;             // Kernel stacks reused from the cache
+  uint ksmiss;            // Kernel stacks newly allocated
+} lwpstat_t;
+
+typedef struct {
+  uint nacquire;          // Acquisitions
+  uint ncontend;          // Acquisitions which found the lock held
+  uint nspin;             // Contended ones which got it by spinning
+  uint nsleep;            // Sleeps while waiting for the lock
+  uint64 spincycles;      // Cycles spent spinning
+} lockstat_t;
+
+// Sleeplocks of getlockstat()
+#define LS_BUF   0        // Buffer cache
+#define LS_INODE 1        // Inode cache
@@ -104,3 +104,29 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Thread-local storage of TLSSIZE bytes, selected by %gs.
+// Word 0 holds its own address.
+void*
+tls(void)
+{
+  void *p;
+
+  asm volatile("movl %%gs:0, %0" : "=r" (p));
+  return p;
+}
+
+uint
+tlsget(int i)
+{
+  uint v;
+
+  asm volatile("movl %%gs:(,%1,4), %0" : "=r" (v) : "r" (i));
+  return v;
+}
+
+void
+tlsset(int i, uint v)
+{
+  asm volatile("movl %0, %%gs:(,%1,4)" : : "r" (v), "r" (i) : "memory");
+}
@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct schedev;
+struct schedlat;
+struct schedparam;
+struct tpool;
 
 // system calls
 int fork(void);
@@ -29,16 +33,22 @@ int set_cpu_share(int);
 int thread_create(thread_t*, void*, void*);
 void thread_exit(void*);
 int thread_join(thread_t, void**);
-int xem_init(xem_t*);
-int xem_wait(xem_t*);
-int xem_unlock(xem_t*);
-int rwlock_init(rwlock_t*);
-int rwlock_acquire_readlock(rwlock_t*);
-int rwlock_acquire_writelock(rwlock_t*);
-int rwlock_release_readlock(rwlock_t*);
-int rwlock_release_writelock(rwlock_t*);
 int pread(int, void*, int, int);
 int pwrite(int, void*, int, int);
+int sched_trace(int);
+int sched_drain(struct schedev*, int);
+int sched_wakeup(int);
+int getschedlat(int, struct schedlat*);
+int sched_setparam(struct schedparam*);
+int sched_getparam(struct schedparam*);
+int set_affinity(int, uint);
+int thread_park(void);
+int thread_unpark(thread_t);
+int getlwpstat(lwpstat_t*);
+int thread_create_attr(thread_t*, void*, void*, thread_attr_t*);
+int spawn(char*, char**, int*);
+int futex(uint*, int, int);
+int getlockstat(int, lockstat_t*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -53,7 +63,27 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+void* tls(void);
+uint tlsget(int);
+void tlsset(int, uint);
 thread_safe_guard* thread_safe_guard_init(int fd);
 int thread_safe_pread(thread_safe_guard* file_guard, void* addr, int n, int off);
 int thread_safe_pwrite(thread_safe_guard* file_guard, void* addr, int n, int off);
 void thread_safe_guard_destroy(thread_safe_guard* file_guard);
+
+// xem.c
+int xem_init(xem_t*);
+int xem_wait(xem_t*);
+int xem_unlock(xem_t*);
+int rwlock_init(rwlock_t*);
+int rwlock_init_policy(rwlock_t*, int);
+int rwlock_acquire_readlock(rwlock_t*);
+int rwlock_acquire_writelock(rwlock_t*);
+int rwlock_release_readlock(rwlock_t*);
+int rwlock_release_writelock(rwlock_t*);
+
+// tpool.c
+struct tpool* tpool_create(int);
+int tpool_submit(struct tpool*, void (*)(void*), void*);
+void tpool_wait(struct tpool*);
+void tpool_destroy(struct tpool*);
@@ -6,6 +6,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "traps.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -26,6 +27,7 @@ seginit(void)
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+  c->gdt[SEG_UTLS] = SEG16(STA_W, 0, TLSSIZE-1, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
 }
 
@@ -173,6 +175,8 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  // %gs is reloaded from here on the way back to user space.
+  mycpu()->gdt[SEG_UTLS] = SEG16(STA_W, p->tlsbase, TLSSIZE-1, DPL_USER);
   lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
@@ -278,6 +282,100 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Serialize TLB shootdowns, so that every tlbreq has one sender.
+static uint tlblock;
+
+// Flush the TLB of this CPU if another one asked for it.
+// Interrupts must be off.
+void
+tlbpoll(void)
+{
+  struct cpu *c = mycpu();
+
+  if(c->tlbreq){
+    lcr3(rcr3());
+    c->tlbreq = 0;
+  }
+}
+
+// Flush the TLB of every CPU which has pgdir loaded, after
+// the caller cleared some of its PTEs, and wait until they
+// have. The others get an IPI; those spinning with interrupts
+// off poll for it, so the caller may hold spinlocks.
+void
+tlbshootdown(pde_t *pgdir)
+{
+  struct cpu *c, *me;
+  struct proc *p;
+  uint sent = 0;
+
+  pushcli();
+  me = mycpu();
+  // The xchg also orders the cleared PTEs before the reads of
+  // c->proc: a CPU that loads pgdir after them walks the new
+  // PTEs, as run() sets c->proc before switchuvm().
+  while(xchg(&tlblock, 1) != 0)
+    tlbpoll();
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    if(c == me || (p = c->proc) == 0 || p->pgdir != pgdir)
+      continue;
+    c->tlbreq = 1;
+    lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+    sent |= 1 << (c - cpus);
+  }
+  for(c = cpus; c < &cpus[ncpu]; c++)
+    while((sent & (1 << (c - cpus))) && c->tlbreq)
+      tlbpoll();
+  xchg(&tlblock, 0);
+  if(rcr3() == V2P(pgdir))
+    lcr3(V2P(pgdir));
+  popcli();
+}
+
+#define NUNMAP 32   // Pages freed per shootdown by unmapuvm()
+
+static void
+unmapfree(pde_t *pgdir, char **mem, int n)
+{
+  int i;
+
+  tlbshootdown(pgdir);
+  for(i = 0; i < n; i++)
+    kfree(mem[i]);
+}
+
+// Like deallocuvm(), for a page table that LWPs may be using
+// on other CPUs. A page is freed only after no TLB maps it.
+int
+unmapuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  char *mem[NUNMAP];
+  pte_t *pte;
+  uint a;
+  int n = 0;
+
+  if(newsz >= oldsz)
+    return oldsz;
+
+  a = PGROUNDUP(newsz);
+  for(; a < oldsz; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if((*pte & PTE_P) != 0){
+      mem[n++] = P2V(PTE_ADDR(*pte));
+      *pte = 0;
+      if(n == NUNMAP){
+        unmapfree(pgdir, mem, n);
+        n = 0;
+      }
+    }
+  }
+  if(n > 0)
+    unmapfree(pgdir, mem, n);
+  return newsz;
+}
+
 // Free a page table and all the physical memory pages
 // in the user part.
 void
@@ -310,55 +408,227 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Map the user page mem at va, unless another thread of the
+// same page table mapped one first; then free mem. Caller must
+// serialize the changes of pgdir.
+int
+mapuser(pde_t *pgdir, uint va, char *mem)
+{
+  pte_t *pte;
+
+  if((pte = walkpgdir(pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P)){
+    kfree(mem);
+    return 0;
+  }
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Map a zeroed user page at va, like mapuser().
+int
+mapzero(pde_t *pgdir, uint va)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  return mapuser(pgdir, va, mem);
+}
+
+// Read the page at va of the program of p from its file.
+// LWPs page in the program of their group.
+static int
+execfault(struct proc *p, uint va)
+{
+  struct proc *q = vmowner(p);
+  struct execseg *s;
+  uint a, b;
+  char *mem;
+  int found = 0;
+
+  if(q->exip == 0)
+    return -1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+
+  ilock(q->exip);
+  for(s = q->exseg; s < &q->exseg[q->nexseg]; s++){
+    if(va + PGSIZE <= s->va || va >= s->va + s->memsz)
+      continue;
+    found = 1;
+    // Bytes past filesz stay zero.
+    a = va > s->va ? va : s->va;
+    b = va + PGSIZE < s->va + s->filesz ? va + PGSIZE : s->va + s->filesz;
+    if(a < b && readi(q->exip, mem + (a - va), s->off + (a - s->va), b - a) != b - a){
+      found = 0;
+      break;
+    }
+  }
+  iunlock(q->exip);
+
+  if(!found){
+    kfree(mem);
+    return -1;
+  }
+  return lwpmapuser(p, va, mem);
+}
+
+// Give pgdir its own writable copy of the copy-on-write page
+// of pte. The last sharer just takes the page over.
+static int
+cowcopy(pte_t *pte)
+{
+  uint pa, flags;
+  char *mem;
+
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(krefs(P2V(pa)) == 1){
+    *pte = pa | flags;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)P2V(pa), PGSIZE);
+  *pte = V2P(mem) | flags;
+  kfree(P2V(pa));
+  return 0;
+}
+
+// Handle a write to the present page at va. Return 0 if it
+// is writable now.
+static int
+cowfault(pde_t *pgdir, uint va, uint err)
+{
+  pte_t *pte;
+
+  if((pte = walkpgdir(pgdir, (char*)va, 0)) == 0 || !(*pte & PTE_P))
+    return -1;
+  if((err & FEC_U) && !(*pte & PTE_U))
+    return -1;
+  if(*pte & PTE_COW)
+    return cowcopy(pte);
+  // Stale TLB entry of a page copied already
+  return (*pte & PTE_W) ? 0 : -1;
+}
+
+// Handle a page fault at va of the current process, in user
+// or kernel mode. Return 0 if the access can be retried, or
+// -1 if the fault is real.
+int
+pgfault(uint va, uint err)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || va >= KERNBASE)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  if(err & FEC_PR){
+    if(!(err & FEC_WR) || cowfault(p->pgdir, va, err) < 0)
+      return -1;
+    lcr3(V2P(p->pgdir));
+    return 0;
+  }
+
+  // LWP stacks are mapped on first touch.
+  if(va >= LWPBASE && lwpfault(p, va) == 0)
+    return 0;
+
+  // So are the pages of the program, and of the heap.
+  if(va < LWPBASE && (execfault(p, va) == 0 || heapfault(p, va) == 0))
+    return 0;
+
+  return -1;
+}
+
+// Fault in the missing pages of [va, va+len) of the current
+// process, so that the kernel can use them while holding
+// locks. Return -1 if any of them can't be mapped.
+int
+prefault(uint va, uint len)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if((pte == 0 || !(*pte & PTE_P)) && pgfault(a, 0) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Map the page of pte at va in d too. With cow, both share
+// it read-only until one of them writes; otherwise d gets a
+// copy.
+static int
+copypage(pde_t *d, pte_t *pte, uint va, int cow)
+{
+  uint pa, flags;
+  char *mem;
+
+  pa = PTE_ADDR(*pte);
+  if(cow){
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    flags = PTE_FLAGS(*pte);
+    if(mappages(d, (void*)va, PGSIZE, pa, flags) < 0)
+      return -1;
+    kref(P2V(pa));
+    return 0;
+  }
+
+  flags = PTE_FLAGS(*pte);
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)P2V(pa), PGSIZE);
+  if(mappages(d, (void*)va, PGSIZE, V2P(mem), flags) < 0) {
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The stack of an LWP in [sksz, sktop)
+// is copied too; pages not touched yet stay unmapped. With
+// cow, the pages are shared copy-on-write, and the caller
+// must flush the TLB of pgdir.
 pde_t*
-copyuvm(pde_t *pgdir, uint hpsz, uint sksz)
+copyuvm(pde_t *pgdir, uint hpsz, uint sksz, uint sktop, int cow)
 {
   pde_t *d;
   pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
+  uint i;
 
   if((d = setupkvm()) == 0)
     return 0;
 
   // Until heap
   for(i = 0; i < hpsz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      break;
-      //panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    // Pages of the program not read yet are left to the child.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    if(copypage(d, pte, i, cow) < 0)
       goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
-    }
   }
 
   if(sksz == 0)
     return d;
 
   // Stack
-  for(i = sksz; i < sksz+(2*PGSIZE); i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm(2): pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm(2): page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+  for(i = sksz; i < sktop; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    if(copypage(d, pte, i, cow) < 0)
       goto bad;
-    }
   }
   return d;
 
@@ -367,6 +637,26 @@ bad:
   return 0;
 }
 
+// Copy every copy-on-write page below sz, before pgdir is
+// shared by LWPs. A fault of one LWP couldn't flush the TLB
+// of the others. The caller must flush the TLB of pgdir.
+int
+uvmunshare(pde_t *pgdir, uint sz)
+{
+  pte_t *pte;
+  uint i;
+
+  for(i = 0; i < sz; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & PTE_P) && (*pte & PTE_COW) && cowcopy(pte) < 0)
+      return -1;
+  }
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -390,10 +680,15 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // Don't write through to a page shared copy-on-write.
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte != 0 && (*pte & PTE_P) && (*pte & PTE_COW) && cowcopy(pte) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
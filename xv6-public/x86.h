@@ -130,6 +130,33 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Index of the least significant set bit. v must be non-zero.
+static inline uint
+bsf(uint v)
+{
+  uint r;
+  asm volatile("bsfl %1,%0" : "=r" (r) : "rm" (v) : "cc");
+  return r;
+}
+
+// Index of the most significant set bit. v must be non-zero.
+static inline uint
+bsr(uint v)
+{
+  uint r;
+  asm volatile("bsrl %1,%0" : "=r" (r) : "rm" (v) : "cc");
+  return r;
+}
+
+// Time stamp counter of this CPU.
+static inline uint64
+rdtsc(void)
+{
+  uint64 r;
+  asm volatile("rdtsc" : "=A" (r));
+  return r;
+}
+
 static inline uint
 rcr2(void)
 {
@@ -144,6 +171,14 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r" (val));
+  return val;
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().
@@ -0,0 +1,193 @@
+// Semaphores and readers-writer locks in user space. The
+// uncontended paths are one atomic instruction; futex() is
+// called only to sleep or to wake up sleepers.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Fields of rwlock_t.state
+#define RWL_R      0x00000001   // An active reader
+#define RWL_RMASK  0x000003ff
+#define RWL_W      0x00000400   // The writer
+#define RWL_WW     0x00000800   // A sleeping writer
+#define RWL_WWMASK 0x001ff800
+#define RWL_RW     0x00200000   // A sleeping reader
+#define RWL_RWMASK 0x7fe00000
+#define RWL_PHASE  0x80000000   // Flipped when waiting readers are let in
+
+#define WAKEALL    0x7fffffff   // futex() count to wake up every waiter
+
+#define cas(p, old, new) __sync_bool_compare_and_swap((p), (old), (new))
+
+// Semaphore
+// The value is -1 while threads may sleep on it, so that
+// xem_unlock() calls futex() only then.
+int
+xem_init(xem_t *xem)
+{
+  xem->value = 1;
+  return 0;
+}
+
+int
+xem_wait(xem_t *xem)
+{
+  int v, slept = 0;
+
+  for(;;){
+    v = xem->value;
+    if(v > 0){
+      // Others may still sleep after we woke up, so taking
+      // the last unit leaves the semaphore contended, and
+      // units left over must wake up the next sleeper, as
+      // xem_unlock() only wakes one when it replaces -1.
+      if(!cas(&xem->value, v, (v == 1 && slept) ? -1 : v-1))
+        continue;
+      if(v > 1 && slept)
+        futex((uint*)&xem->value, FUTEX_WAKE, 1);
+      return 0;
+    }
+    if(v == 0 && !cas(&xem->value, 0, -1))
+      continue;
+    futex((uint*)&xem->value, FUTEX_WAIT, -1);
+    slept = 1;
+  }
+}
+
+int
+xem_unlock(xem_t *xem)
+{
+  int v;
+
+  do
+    v = xem->value;
+  while(!cas(&xem->value, v, v < 0 ? 1 : v+1));
+
+  // Wake up the longest sleeper only.
+  if(v < 0)
+    futex((uint*)&xem->value, FUTEX_WAKE, 1);
+  return 0;
+}
+
+// Readers-writer Lock
+// The state word counts active readers, and sleeping readers
+// and writers, so no pid list is needed. The policy decides
+// when a reader may enter:
+//   RWP_READER  while no writer holds the lock; writers may starve
+//   RWP_WRITER  while no writer holds or waits; readers may starve
+//   RWP_FAIR    as RWP_WRITER, but readers blocked by a writer
+//               are let in together when it releases, before any
+//               later writer (phase-fair)
+int
+rwlock_init(rwlock_t *rwlock)
+{
+  return rwlock_init_policy(rwlock, RWP_READER);
+}
+
+int
+rwlock_init_policy(rwlock_t *rwlock, int policy)
+{
+  if(policy != RWP_READER && policy != RWP_WRITER && policy != RWP_FAIR)
+    return -1;
+  rwlock->state = 0;
+  rwlock->policy = policy;
+  return 0;
+}
+
+static int
+rdok(rwlock_t *rwlock, uint s)
+{
+  if(s & RWL_W)
+    return 0;
+  return rwlock->policy == RWP_READER || (s & RWL_WWMASK) == 0;
+}
+
+int
+rwlock_acquire_readlock(rwlock_t *rwlock)
+{
+  uint s, phase = 0;
+  int slept = 0;
+
+  for(;;){
+    s = rwlock->state;
+    // A phase-fair reader is let in by the writer, which
+    // counts it and flips RWL_PHASE.
+    if(slept && rwlock->policy == RWP_FAIR){
+      if((s & RWL_PHASE) != phase)
+        return 0;
+      futex((uint*)&rwlock->state, FUTEX_WAIT, s);
+      continue;
+    }
+    if(rdok(rwlock, s)){
+      if(cas(&rwlock->state, s, s + RWL_R - (slept ? RWL_RW : 0)))
+        return 0;
+      continue;
+    }
+    if(!slept){
+      if(!cas(&rwlock->state, s, s + RWL_RW))
+        continue;
+      s += RWL_RW;
+      phase = s & RWL_PHASE;
+      slept = 1;
+    }
+    futex((uint*)&rwlock->state, FUTEX_WAIT, s);
+  }
+}
+
+int
+rwlock_acquire_writelock(rwlock_t *rwlock)
+{
+  uint s;
+  int slept = 0;
+
+  for(;;){
+    s = rwlock->state;
+    if((s & (RWL_RMASK|RWL_W)) == 0){
+      if(cas(&rwlock->state, s, (s | RWL_W) - (slept ? RWL_WW : 0)))
+        return 0;
+      continue;
+    }
+    if(!slept){
+      if(!cas(&rwlock->state, s, s + RWL_WW))
+        continue;
+      s += RWL_WW;
+      slept = 1;
+    }
+    futex((uint*)&rwlock->state, FUTEX_WAIT, s);
+  }
+}
+
+int
+rwlock_release_readlock(rwlock_t *rwlock)
+{
+  uint s;
+
+  s = rwlock->state;
+  if((s & RWL_RMASK) == 0)
+    return -1;
+  // Only the last reader lets a writer in.
+  s = __sync_sub_and_fetch(&rwlock->state, RWL_R);
+  if((s & RWL_RMASK) == 0 && (s & RWL_WWMASK) != 0)
+    futex((uint*)&rwlock->state, FUTEX_WAKE, WAKEALL);
+  return 0;
+}
+
+int
+rwlock_release_writelock(rwlock_t *rwlock)
+{
+  uint s, ns, nr;
+
+  do{
+    s = rwlock->state;
+    if((s & RWL_W) == 0)
+      return -1;
+    ns = s & ~RWL_W;
+    if(rwlock->policy == RWP_FAIR && (nr = (s & RWL_RWMASK) / RWL_RW) != 0)
+      ns = ((ns & ~RWL_RWMASK) ^ RWL_PHASE) + nr*RWL_R;
+  }while(!cas(&rwlock->state, s, ns));
+
+  if(s & (RWL_RWMASK|RWL_WWMASK))
+    futex((uint*)&rwlock->state, FUTEX_WAKE, WAKEALL);
+  return 0;
+}